@@ -0,0 +1,30 @@
+# --archive: tar and zip members are included like files, an entry may live in an archive,
+# and --check notices a changed member.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p lib/common
+echo 'fn m() {}' > lib/common/math.wgsl
+printf '#include "math.wgsl"\nfn entry() {}\n' > lib/common/entry.wgsl
+tar cf lib.tar -C lib common
+printf '#include "lib.tar/common/math.wgsl"\nfn main() {}\n' > a.wgsl
+
+./wp --archive lib.tar a.wgsl out.wgsl
+grep -q 'fn m()' out.wgsl || fail "the tar member was not included: $(cat out.wgsl)"
+./wp --check out.wgsl || fail "a fresh output is reported stale"
+./wp --archive lib.tar --no-plan lib.tar/common/entry.wgsl entry.wgsl || fail "an entry inside the archive failed"
+grep -q 'fn m()' entry.wgsl || fail "a relative include inside the archive was not resolved: $(cat entry.wgsl)"
+
+echo 'fn m2() {}' > lib/common/math.wgsl
+tar cf lib.tar -C lib common
+if ./wp --check out.wgsl 2>stale.txt; then fail "a changed archive member went unnoticed"; fi
+grep -q 'lib.tar/common/math.wgsl changed' stale.txt || fail "unexpected reason: $(cat stale.txt)"
+
+command -v python3 >/dev/null 2>&1 || skip "python3 is not installed"
+python3 - <<'PYTHON'
+import zipfile
+with zipfile.ZipFile("lib.zip", "w", zipfile.ZIP_STORED) as archive:
+    archive.writestr("shapes/circle.wgsl", "fn circle() {}\n")
+PYTHON
+printf '#include "lib.zip/shapes/circle.wgsl"\nfn main() {}\n' > z.wgsl
+./wp --archive lib.zip z.wgsl zout.wgsl
+grep -q 'fn circle()' zout.wgsl || fail "the zip member was not included: $(cat zout.wgsl)"
@@ -0,0 +1,25 @@
+# --axis: only axes some reachable condition depends on multiply the variants, and each
+# variant holds the bundle evaluated for its defines.
+. "$(dirname "$0")/common.sh"
+
+cat > a.wgsl <<'WGSL'
+#ifdef FAST
+fn fast() {}
+#if QUALITY > 1
+fn high() {}
+#endif
+#endif
+fn main() {}
+WGSL
+./wp --axis FAST --axis QUALITY=1,2 --axis DEBUG a.wgsl out.wgsl || fail "preprocessor exited with $?"
+
+# QUALITY only matters with FAST, DEBUG never: 3 variants instead of 8
+[ "$(wc -l < out.wgsl.variants | tr -d ' ')" = 3 ] || fail "unexpected variants: $(cat out.wgsl.variants)"
+if grep -q DEBUG out.wgsl.variants; then fail "an irrelevant axis was expanded"; fi
+grep -q "^!FAST	out.wgsl$" out.wgsl.variants || fail "QUALITY was expanded without FAST"
+
+variant() { awk -F '\t' -v defines="$1" '$1 == defines { print $2 }' out.wgsl.variants; }
+[ "$(cat "$(variant '!FAST')")" = 'fn main() {}' ] || fail "wrong !FAST variant"
+[ "$(cat "$(variant 'FAST=1 QUALITY=1')")" = "$(printf 'fn fast() {}\nfn main() {}')" ] || fail "wrong QUALITY=1 variant"
+[ "$(cat "$(variant 'FAST=1 QUALITY=2')")" = "$(printf 'fn fast() {}\nfn high() {}\nfn main() {}')" ] ||
+    fail "wrong QUALITY=2 variant"
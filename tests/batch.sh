@@ -0,0 +1,19 @@
+# --batch: every entry of the list gets the output a single run would give it, entries sharing
+# includes included; a failing entry fails the run without stopping the others.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn shared() {}' > shared.wgsl
+for i in $(seq 20); do
+    printf '#include "shared.wgsl"\nfn e%s() {}\n' $i > e$i.wgsl
+    printf 'e%s.wgsl o%s.wgsl\n' $i $i >> list
+done
+./wp --batch list || fail "the batch failed"
+for i in $(seq 20); do
+    ./wp --no-plan e$i.wgsl single.wgsl
+    cmp -s o$i.wgsl single.wgsl || fail "entry $i differs from a single run: $(cat o$i.wgsl)"
+done
+
+printf '#include "missing.wgsl"\nfn broken() {}\n' > e7.wgsl
+echo 'fn shared2() {}' > shared.wgsl
+if ./wp --batch list 2>/dev/null; then fail "a failing entry did not fail the batch"; fi
+grep -q 'fn shared2()' o20.wgsl || fail "entries after the failing one were not rebuilt"
@@ -0,0 +1,22 @@
+# --cache-size: the --cache-dir stays under its cap, and the entries that go are the least
+# recently used, hits counting as uses.
+. "$(dirname "$0")/common.sh"
+
+# Each table is about 860 bytes: three fit under a 3000 byte cap, four do not
+for i in 1 2 3 4; do
+    head -c 256 /dev/urandom > data$i.bin
+    printf '#embed "data%s.bin" u32 TABLE%s\n' $i $i > e$i.wgsl
+done
+build() { ./wp --no-plan --cache-dir cache --cache-size 3000 e$1.wgsl out$1.wgsl || fail "entry $1 failed"; }
+cached() { grep -l "TABLE$1 " cache/*.wgsl 2>/dev/null | wc -l | tr -d ' '; }
+
+# Access times have a resolution of one second
+build 1; sleep 1; build 2; sleep 1; build 3
+for i in 1 2 3; do [ "$(cached $i)" = 1 ] || fail "table $i was not cached"; done
+sleep 1; build 1
+sleep 1; build 4
+
+[ "$(cached 2)" = 0 ] || fail "the least recently used table survived"
+for i in 1 3 4; do [ "$(cached $i)" = 1 ] || fail "table $i was evicted out of order"; done
+total=$(find cache -name '*.wgsl' -exec cat {} + | wc -c | tr -d ' ')
+[ "$total" -le 3000 ] || fail "the cache holds $total bytes"
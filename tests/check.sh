@@ -0,0 +1,27 @@
+# --check: exit status only. Fresh outputs pass, a stale, modified or planless one fails with
+# its reason, and nothing is ever written.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn b() {}' > b.wgsl
+printf '#include "b.wgsl"\nfn a() {}\n' > a.wgsl
+echo 'fn c() {}' > c.wgsl
+./wp a.wgsl a.out
+./wp c.wgsl c.out
+./wp --check a.out c.out || fail "fresh outputs are reported stale"
+
+listing() { ls -l --full-time a.out a.out.plan c.out c.out.plan; }
+before=$(listing)
+echo 'fn b2() {}' > b.wgsl
+if ./wp --check a.out c.out 2>stale.txt; then fail "a changed include went unnoticed"; fi
+grep -q '^Stale: a.out: .*b.wgsl changed' stale.txt || fail "unexpected report: $(cat stale.txt)"
+if grep -q 'c.out' stale.txt; then fail "a fresh output was reported: $(cat stale.txt)"; fi
+[ "$(listing)" = "$before" ] || fail "--check wrote to an output or plan"
+
+./wp a.wgsl a.out
+echo 'edited' >> c.out
+if ./wp --check c.out 2>stale.txt; then fail "a modified output went unnoticed"; fi
+grep -q 'output was modified' stale.txt || fail "unexpected report: $(cat stale.txt)"
+
+./wp --no-plan c.wgsl d.out
+if ./wp --check d.out 2>stale.txt; then fail "an output without a plan passed"; fi
+grep -q 'no plan recorded' stale.txt || fail "unexpected report: $(cat stale.txt)"
@@ -0,0 +1,27 @@
+# Sourced by every test script; $1 is the preprocessor binary under test.
+#
+# Each test runs in a scratch directory holding a copy of the binary, since input files are
+# resolved against the executable's directory. Exit status 77 marks a test as skipped.
+set -eu
+
+binary=$1
+work=$(mktemp -d)
+background=""
+trap 'if [ -n "$background" ]; then kill $background 2>/dev/null || true; fi; rm -rf "$work"' EXIT
+cp "$binary" "$work/wp"
+cd "$work"
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+skip()
+{
+    echo "SKIP: $*"
+    exit 77
+}
+
+# A port for servers started by the test, spread by process id so parallel runs do not collide.
+port=$((20000 + $$ % 20000))
@@ -0,0 +1,32 @@
+# .gz and .zst sources: replaying a plan (and --emit-layout, which always assembles) reads the
+# decompressed text, not the bytes on disk.
+. "$(dirname "$0")/common.sh"
+
+command -v gzip >/dev/null 2>&1 || skip "gzip is not installed"
+printf 'struct S { a: f32 };\n' > s.wgsl
+gzip -k s.wgsl
+printf '#include "s.wgsl.gz"\nfn main() {}\n' > a.wgsl
+printf 'struct S { a: f32 };\nfn main() {}\n' > expected.wgsl
+
+if ! ./wp a.wgsl out.wgsl 2>errors.txt; then
+    grep -q 'need a build with zlib' errors.txt && skip "built without zlib"
+    fail "preprocessing failed: $(cat errors.txt)"
+fi
+cmp -s out.wgsl expected.wgsl || fail "wrong output: $(cat out.wgsl)"
+
+echo '// edited' >> out.wgsl # the inputs are unchanged, so this replays the plan
+./wp a.wgsl out.wgsl
+cmp -s out.wgsl expected.wgsl || fail "the replayed output differs"
+
+./wp --emit-layout layout.h a.wgsl out.wgsl
+cmp -s out.wgsl expected.wgsl || fail "the output differs with --emit-layout"
+grep -q '^struct alignas(4) S$' layout.h || fail "no layout for S"
+
+command -v zstd >/dev/null 2>&1 || skip "zstd is not installed"
+zstd -q s.wgsl -o t.wgsl.zst
+printf '#include "t.wgsl.zst"\nfn main() {}\n' > z.wgsl
+if ! ./wp z.wgsl zout.wgsl 2>errors.txt; then
+    grep -q 'need a build with libzstd' errors.txt && skip "built without libzstd"
+    fail "preprocessing failed: $(cat errors.txt)"
+fi
+cmp -s zout.wgsl expected.wgsl || fail "wrong output from .zst: $(cat zout.wgsl)"
@@ -0,0 +1,31 @@
+# wgslPreprocessorConsteval.hpp: the bundle resolved at compile time equals the tool's output
+# for the same files, checked by a static_assert.
+root=$(cd "$(dirname "$0")/.." && pwd)
+. "$(dirname "$0")/common.sh"
+
+compiler=${CXX:-c++}
+command -v "$compiler" >/dev/null 2>&1 || skip "no C++ compiler"
+printf '#include <string>\nconstexpr bool f() { std::string s = "x"; return s.size() == 1; }\nstatic_assert(f());\n' > probe.cpp
+"$compiler" -std=c++20 -fsyntax-only probe.cpp 2>/dev/null || skip "$compiler lacks constexpr std::string"
+
+mkdir -p common lights
+echo 'fn square(x: f32) -> f32 { return x * x; }' > common/math.wgsl
+printf '#include "../common/math.wgsl"\nfn light() -> f32 { return square(2.0); }\n' > lights/point.wgsl
+printf '#include "common/math.wgsl"\n#include "lights/point.wgsl"\n@compute @workgroup_size(1) fn main() {}\n' > main.wgsl
+./wp --no-plan main.wgsl out.wgsl
+
+literal() { printf 'R"wgsl(%s\n)wgsl"' "$(cat "$1")"; }
+cat > main.cpp <<CPP
+#include "wgslPreprocessorConsteval.hpp"
+
+inline constexpr wgsl::SourceFile shaders[] = {
+    {"common/math.wgsl", $(literal common/math.wgsl)},
+    {"lights/point.wgsl", $(literal lights/point.wgsl)},
+    {"main.wgsl", $(literal main.wgsl)},
+};
+constexpr auto bundle = wgsl::resolveIncludes<shaders, "main.wgsl">();
+static_assert(bundle.view() == std::string_view($(literal out.wgsl)));
+
+int main() { return 0; }
+CPP
+"$compiler" -std=c++20 -fsyntax-only -I"$root" main.cpp || fail "the compile-time bundle differs from the tool's output"
@@ -0,0 +1,68 @@
+# --serve: options the daemon cannot honour are refused, outputs are written whole, requests
+# show up in the metrics, an idle client neither blocks other clients for long nor keeps
+# SIGTERM from stopping the daemon, and neither does an idle metrics connection.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn a() {}' > a.wgsl
+for option in "--archive lib.tar" "--git-rev HEAD" "--generator x=true" "--prefix p.snap" "-D A"; do
+    ./wp --serve "$work/refused.sock" $option 2>/dev/null &
+    refused=$!
+    background=$refused
+    (sleep 5; kill $refused 2>/dev/null) &
+    watchdog=$!
+    status=0
+    wait $refused || status=$?
+    kill $watchdog 2>/dev/null || true
+    [ $status -eq 1 ] || fail "--serve did not refuse $option (status $status)"
+done
+
+command -v python3 >/dev/null 2>&1 || skip "python3 is not installed"
+./wp --serve "$work/daemon.sock" --metrics-port $port &
+daemon=$!
+background=$daemon
+for attempt in $(seq 50); do
+    [ -S daemon.sock ] && break
+    sleep 0.1
+done
+
+./wp --connect "$work/daemon.sock" a.wgsl "$work/out.wgsl" >/dev/null || fail "a request for an output file failed"
+[ "$(cat out.wgsl)" = 'fn a() {}' ] || fail "the daemon wrote $(cat out.wgsl)"
+
+python3 - $port > metrics.txt <<'PYTHON' || fail "the metrics endpoint did not answer"
+import socket, sys
+metrics = socket.create_connection(("127.0.0.1", int(sys.argv[1])), timeout=10)
+metrics.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+reply = b""
+while chunk := metrics.recv(65536):
+    reply += chunk
+sys.stdout.write(reply.decode())
+PYTHON
+grep -q '^wgsl_requests_total 1$' metrics.txt || fail "the request was not counted: $(cat metrics.txt)"
+grep -q '^wgsl_request_duration_seconds_count 1$' metrics.txt || fail "the request latency was not recorded"
+grep -q '^wgsl_request_duration_seconds_bucket{le="+Inf"} 1$' metrics.txt || fail "the latency histogram has no +Inf bucket"
+
+python3 - "$work/daemon.sock" <<'PYTHON' || fail "a request behind an idle client did not complete"
+import socket, subprocess, sys, time
+idle = socket.socket(socket.AF_UNIX)
+idle.connect(sys.argv[1])
+start = time.time()
+result = subprocess.run(["./wp", "--connect", sys.argv[1], "a.wgsl"], capture_output=True, timeout=30)
+sys.exit(0 if result.returncode == 0 and result.stdout == b"fn a() {}\n" and time.time() - start < 15 else 1)
+PYTHON
+
+python3 - "$work/daemon.sock" $port <<'PYTHON' &
+import socket, sys, time
+idle = socket.socket(socket.AF_UNIX)
+idle.connect(sys.argv[1])
+metrics = socket.create_connection(("127.0.0.1", int(sys.argv[2])))
+time.sleep(10)
+PYTHON
+background="$daemon $!"
+sleep 0.5
+kill -TERM $daemon
+(sleep 4; kill -KILL $daemon 2>/dev/null) &
+watchdog=$!
+status=0
+wait $daemon || status=$?
+kill $watchdog 2>/dev/null || true
+[ $status -eq 0 ] || fail "the daemon did not stop on SIGTERM (status $status)"
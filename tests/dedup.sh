@@ -0,0 +1,30 @@
+# --dedup-outputs: identical outputs of one batch share storage, and rewriting one of them
+# later leaves its twins alone.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn same() {}' > same.wgsl
+for i in 1 2 3; do
+    echo '#include "same.wgsl"' > e$i.wgsl
+    printf 'e%s.wgsl o%s.wgsl\n' $i $i >> list
+done
+echo 'fn other() {}' > e4.wgsl
+printf 'e4.wgsl o4.wgsl\n' >> list
+./wp --dedup-outputs --batch list || fail "the batch failed"
+
+for i in 2 3; do
+    cmp -s o1.wgsl o$i.wgsl || fail "o$i.wgsl differs from o1.wgsl"
+done
+inode() { ls -i "$1" | awk '{ print $1 }'; }
+if [ "$(inode o1.wgsl)" != "$(inode o2.wgsl)" ] || [ "$(inode o1.wgsl)" != "$(inode o3.wgsl)" ]; then
+    # Reflinked twins keep their own inodes; only filesystems that can clone may have them
+    case "$(stat -f -c %T . 2>/dev/null)" in
+        btrfs | xfs | bcachefs) ;;
+        *) fail "identical outputs were not hardlinked" ;;
+    esac
+fi
+[ "$(inode o4.wgsl)" != "$(inode o1.wgsl)" ] || fail "a different output was linked"
+
+echo 'fn changed() {}' > e2.wgsl
+./wp --dedup-outputs --batch list || fail "the second batch failed"
+grep -q 'fn changed()' o2.wgsl || fail "o2.wgsl was not rewritten"
+grep -q 'fn same()' o1.wgsl && grep -q 'fn same()' o3.wgsl || fail "rewriting o2.wgsl changed its twins"
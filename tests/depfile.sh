@@ -0,0 +1,22 @@
+# --depfile: make can parse it, ':' is escaped, archives stand in for their members and
+# generated inputs are left out.
+. "$(dirname "$0")/common.sh"
+
+command -v make >/dev/null 2>&1 || skip "make is not installed"
+mkdir lib
+echo 'fn m() {}' > lib/math.wgsl
+tar cf lib.tar -C lib math.wgsl
+echo 'fn c() {}' > 'a:b.wgsl'
+printf '#include "lib.tar/math.wgsl"\n#include "a:b.wgsl"\n#include "gen:lights?count=8"\nfn main() {}\n' > a.wgsl
+./wp --archive lib.tar --generator 'lights=echo "const N = 1;"' --depfile out.d a.wgsl out.wgsl
+
+grep -q '/lib\.tar \\$' out.d || fail "the archive is not listed: $(cat out.d)"
+if grep -q 'lib\.tar/math' out.d; then fail "an archive member is listed as a file"; fi
+if grep -q 'gen:' out.d; then fail "a generated input is listed"; fi
+grep -q 'a\\:b\.wgsl' out.d || fail "':' is not escaped"
+
+printf 'out.wgsl:\n\ttouch out.wgsl\ninclude out.d\n' > Makefile
+make -q || fail "make cannot read the depfile, or the output is not up to date"
+sleep 1
+touch lib.tar
+if make -q; then fail "make did not pick up the changed archive"; fi
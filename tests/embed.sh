@@ -0,0 +1,46 @@
+# #embed: binary and CSV data become typed arrays, data is read through the providers (archives,
+# generators) and is an input of the plan; CSV values are separated by ',' and whitespace only;
+# a failed #embed fails the build.
+. "$(dirname "$0")/common.sh"
+
+printf '\001\000\000\000\377\377\377\377' > data.bin
+printf '1.5, -2 0.1\n' > floats.csv
+printf '#embed "data.bin" u32 U\n#embed "data.bin" i32 I\n#embed "floats.csv" f32 F\n' > typed.wgsl
+./wp typed.wgsl typed.out || fail "embedding typed data failed"
+cat > expected.out <<'WGSL'
+const U = array<u32, 2>(
+    1u, 4294967295u,
+);
+const I = array<i32, 2>(
+    1i, -1i,
+);
+const F = array<f32, 3>(
+    1.5f, -2f, 0.1f,
+);
+WGSL
+cmp -s typed.out expected.out || fail "unexpected tables: $(cat typed.out)"
+
+mkdir d
+printf '1, 2, 3\n' > d/v.csv
+printf '#embed "v.csv" u32 V\n' > d/e.wgsl
+tar cf lib.tar -C d v.csv e.wgsl
+printf '#include "lib.tar/e.wgsl"\n#embed "gen:table.csv?x" u32 G\nfn main() {}\n' > a.wgsl
+./wp --archive lib.tar --generator 'table.csv=echo 7,8' a.wgsl out.wgsl
+grep -q '1u, 2u, 3u,' out.wgsl || fail "data inside the archive was not embedded: $(cat out.wgsl)"
+grep -q '7u, 8u,' out.wgsl || fail "generated data was not embedded: $(cat out.wgsl)"
+./wp --check out.wgsl || fail "an output with embedded data is reported stale"
+
+printf '1, 2, 4\n' > d/v.csv
+tar cf lib.tar -C d v.csv e.wgsl
+if ./wp --check out.wgsl 2>/dev/null; then fail "changed embedded data went unnoticed"; fi
+
+printf '1+2\n' > plus.csv
+printf '#embed "plus.csv" u32 P\n' > plus.wgsl
+if ./wp plus.wgsl plus.out 2>errors.txt; then fail "invalid CSV data did not fail the build"; fi
+grep -q 'Invalid data in embedded file' errors.txt || fail "'+' was accepted as a separator"
+if ./wp plus.wgsl plus.out 2>/dev/null; then fail "the second build with invalid CSV data succeeded"; fi
+
+printf '#embed "missing.bin" u32 M\n' > missing.wgsl
+if ./wp missing.wgsl missing.out 2>/dev/null; then fail "a missing data file did not fail the build"; fi
+printf '#embed "d/v.csv" u32\n' > malformed.wgsl
+if ./wp malformed.wgsl malformed.out 2>/dev/null; then fail "a malformed #embed did not fail the build"; fi
@@ -0,0 +1,19 @@
+# --generator: generated inputs are checkable, stay out of --project-root, the command is part
+# of the plan key, and each distinct include runs the command once.
+. "$(dirname "$0")/common.sh"
+
+mkdir sub
+printf '#include "gen:lights?count=8"\nfn main() {}\n' > sub/a.wgsl
+./wp --generator 'lights=echo "const N = 8;"' --project-root . sub/a.wgsl out.wgsl
+grep -q 'const N = 8;' out.wgsl || fail "generated text missing"
+./wp --project-root . --check out.wgsl || fail "a generated input is reported stale"
+./wp --check out.wgsl || fail "a generated input is reported stale without --project-root"
+
+./wp --generator 'lights=echo "const M = 8;"' --project-root . sub/a.wgsl out.wgsl
+grep -q 'const M = 8;' out.wgsl || fail "the plan was reused after the generator command changed"
+
+# Memoized per name and arguments: the same generated include from two files runs once
+printf '#include "gen:lights?count=8"\nfn b() {}\n' > sub/b.wgsl
+printf '#include "b.wgsl"\n#include "gen:lights?count=8"\n#include "gen:lights?count=4"\nfn main() {}\n' > sub/c.wgsl
+./wp --no-plan --generator "lights=echo run >> '$work/runs'; echo 'const N = 8;'" sub/c.wgsl c.wgsl
+[ "$(wc -l < runs | tr -d ' ')" = 2 ] || fail "expected one run per distinct argument list, got $(wc -l < runs)"
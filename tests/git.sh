@@ -0,0 +1,37 @@
+# --git-rev: ~<n> walks first parents, ^<n> takes the n-th parent, and a missing parent fails.
+. "$(dirname "$0")/common.sh"
+
+command -v git >/dev/null 2>&1 || skip "git is not installed"
+export GIT_AUTHOR_NAME=test GIT_AUTHOR_EMAIL=test@example.com GIT_COMMITTER_NAME=test GIT_COMMITTER_EMAIL=test@example.com
+git init -q .
+git symbolic-ref HEAD refs/heads/main
+echo 'fn base() {}' > s.wgsl
+git add s.wgsl && git commit -qm base
+git checkout -qb side
+echo 'fn side() {}' > s.wgsl
+git commit -qam side
+git checkout -q main
+echo 'fn other() {}' > t.wgsl
+git add t.wgsl && git commit -qm other
+git merge -q --no-commit side >/dev/null 2>&1
+echo 'fn merged() {}' > s.wgsl
+git add s.wgsl && git commit -qm merge
+echo 'fn worktree() {}' > s.wgsl
+
+expect()
+{
+    rm -f out.wgsl out.wgsl.plan
+    ./wp --git-rev "$1" s.wgsl out.wgsl 2>errors.txt || true
+    if grep -q 'needs a build with zlib' errors.txt; then skip "built without zlib"; fi
+    [ "$(cat out.wgsl 2>/dev/null)" = "$2" ] || fail "$1 read: $(cat out.wgsl 2>/dev/null) $(cat errors.txt)"
+}
+expect 'HEAD' 'fn merged() {}'
+expect 'HEAD^0' 'fn merged() {}'
+expect 'HEAD^1' 'fn base() {}'
+expect 'HEAD^2' 'fn side() {}'
+expect 'HEAD~1' 'fn base() {}'
+expect 'HEAD^2~1' 'fn base() {}'
+expect 'main~2' 'fn base() {}'
+
+if ./wp --git-rev 'HEAD^3' s.wgsl out.wgsl 2>errors.txt; then fail "HEAD^3 of a two-parent merge resolved"; fi
+grep -q 'No such ancestor' errors.txt || fail "unexpected error: $(cat errors.txt)"
@@ -0,0 +1,20 @@
+# --journal: a torn tail is cut off, so records appended by the next run are read back.
+. "$(dirname "$0")/common.sh"
+
+for i in 1 2 3; do
+    echo "fn f$i() {}" > e$i.wgsl
+    printf 'e%s.wgsl\to%s.wgsl\n' $i $i >> list
+done
+size() { wc -c < journal | tr -d ' '; }
+
+./wp --no-plan --journal journal --batch list
+complete=$(size)
+printf 'torn' >> journal
+echo 'fn g() {}' >> e1.wgsl
+./wp --no-plan --journal journal --batch list
+grep -q 'fn g()' o1.wgsl || fail "the edited entry was not rebuilt"
+rebuilt=$(size)
+[ "$rebuilt" -gt "$complete" ] || fail "no record was appended"
+
+./wp --no-plan --journal journal --batch list
+[ "$(size)" = "$rebuilt" ] || fail "entries were rebuilt although the journal recorded them"
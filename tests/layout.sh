@@ -0,0 +1,24 @@
+# --emit-layout: structs follow the structs they use, user structs win over
+# shorthand-like names, and C++ keywords are escaped.
+. "$(dirname "$0")/common.sh"
+
+cat > a.wgsl <<'WGSL'
+struct Outer { inner: Inner, xor: f32, lights: array<Light, 2> };
+alias Light = Inner2;
+struct Inner2 { p: vec3f };
+struct Inner { a: vec4f, m: material };
+struct material { id: vec2u, basis: mat3x3h };
+WGSL
+./wp --emit-layout layout.h a.wgsl out.wgsl || fail "preprocessor exited with $?"
+
+line() { grep -n "^struct alignas([0-9]*) $1\$" layout.h | cut -d: -f1; }
+[ "$(line Inner)" -lt "$(line Outer)" ] && [ "$(line Inner2)" -lt "$(line Outer)" ] ||
+    fail "structs are not in dependency order"
+grep -q 'material m;' layout.h || fail "a struct named like a matrix shorthand is not resolved"
+grep -q 'float xor_;' layout.h || fail "the alternative token xor is not escaped"
+
+compiler=${CXX:-c++}
+if command -v "$compiler" >/dev/null 2>&1; then
+    printf '#include "layout.h"\nint main() { return 0; }\n' > main.cpp
+    "$compiler" -std=c++17 -fsyntax-only main.cpp || fail "the generated header does not compile"
+fi
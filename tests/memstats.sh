@@ -0,0 +1,12 @@
+# --mem-stats: every subsystem that does work while preprocessing is charged for it.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn b() {}' > b.wgsl
+printf '#include "b.wgsl"\nfn main() {}\n' > a.wgsl
+./wp --no-plan --mem-stats a.wgsl out.wgsl 2>stats.txt || fail "preprocessor exited with $?"
+grep -q 'not available in this build' stats.txt && skip "built without WGSL_MEMORY_STATS"
+for subsystem in paths sources graph output; do
+    allocations=$(awk -v name=$subsystem '$1 == name { print $2 }' stats.txt)
+    [ -n "$allocations" ] || fail "no row for $subsystem: $(cat stats.txt)"
+    [ "$allocations" -gt 0 ] || fail "nothing was charged to $subsystem: $(cat stats.txt)"
+done
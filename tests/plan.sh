@@ -0,0 +1,31 @@
+# Plans: a lost output is replayed from its plan, and a corrupt plan only forces a rebuild.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn b() {}' > b.wgsl
+printf '#include "b.wgsl"\nfn main() {}\n' > a.wgsl
+./wp a.wgsl out.wgsl
+cp out.wgsl expected.wgsl
+[ -f out.wgsl.plan ] || fail "no plan was written"
+
+rm out.wgsl
+./wp a.wgsl out.wgsl
+cmp -s out.wgsl expected.wgsl || fail "the replayed output differs: $(cat out.wgsl)"
+
+# Without literals the plan ends in the segment count, the segments and an empty literal
+# string; find the count by trying the candidates and overwrite it with a huge one.
+size=$(wc -c < out.wgsl.plan | tr -d ' ')
+offset=""
+for count in 1 2 3 4 5 6 7 8; do
+    candidate=$((size - 16 - 24 * count))
+    if [ "$(od -A n -t u8 -j $candidate -N 8 out.wgsl.plan | tr -d ' ')" = "$count" ]; then
+        offset=$candidate
+        break
+    fi
+done
+[ -n "$offset" ] || fail "cannot find the segment count in the plan"
+printf '\377\377\377\377\377\377\377\017' | dd of=out.wgsl.plan bs=1 seek=$offset conv=notrunc 2>/dev/null
+
+rm out.wgsl
+./wp a.wgsl out.wgsl || fail "a corrupt plan failed the build (status $?)"
+cmp -s out.wgsl expected.wgsl || fail "the rebuilt output differs: $(cat out.wgsl)"
+./wp --check out.wgsl || fail "the plan was not rewritten after the rebuild"
@@ -0,0 +1,18 @@
+# --write-prefix/--prefix: an entry starting from a snapshot gets the same output as one
+# resolving everything, and a stale snapshot is ignored with a warning.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn base() {}' > base.wgsl
+printf '#include "base.wgsl"\nfn common() {}\n' > common.wgsl
+printf '#include "common.wgsl"\nfn main() {}\n' > e.wgsl
+./wp --write-prefix common.snap common.wgsl common.out || fail "writing the snapshot failed"
+./wp --no-plan e.wgsl expected.wgsl
+
+./wp --prefix common.snap e.wgsl out.wgsl 2>errors.txt || fail "building from the snapshot failed"
+[ ! -s errors.txt ] || fail "unexpected warnings: $(cat errors.txt)"
+cmp -s out.wgsl expected.wgsl || fail "the output differs with the snapshot: $(cat out.wgsl)"
+
+echo 'fn base2() {}' > base.wgsl
+./wp --prefix common.snap e.wgsl out.wgsl 2>errors.txt
+grep -q 'stale' errors.txt || fail "a stale snapshot was not reported: $(cat errors.txt)"
+grep -q 'fn base2()' out.wgsl || fail "a stale snapshot was used: $(cat out.wgsl)"
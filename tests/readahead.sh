@@ -0,0 +1,26 @@
+# Readahead of the files a stale plan predicts: a prediction that no longer holds (an include
+# removed, renamed or edited) costs nothing but the wasted read, in single and batch runs.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn old() {}' > old.wgsl
+echo 'fn kept() {}' > kept.wgsl
+printf '#include "old.wgsl"\n#include "kept.wgsl"\nfn main() {}\n' > a.wgsl
+printf 'a.wgsl\tbatch.out\n' > list
+./wp a.wgsl single.out
+./wp --batch list
+
+rm old.wgsl
+echo 'fn new() {}' > new.wgsl
+echo 'fn kept2() {}' > kept.wgsl
+printf '#include "new.wgsl"\n#include "kept.wgsl"\nfn main() {}\n' > a.wgsl
+./wp --no-plan a.wgsl reference.out
+expected=$(cat reference.out)
+grep -q "fn kept2()" reference.out && grep -q "fn new()" reference.out || fail "unexpected reference output: $expected"
+
+./wp a.wgsl single.out 2>errors.txt || fail "the single run failed: $(cat errors.txt)"
+[ ! -s errors.txt ] || fail "a stale prediction was reported: $(cat errors.txt)"
+[ "$(cat single.out)" = "$expected" ] || fail "wrong single output: $(cat single.out)"
+
+./wp --batch list 2>errors.txt || fail "the batch run failed: $(cat errors.txt)"
+[ ! -s errors.txt ] || fail "a stale prediction was reported: $(cat errors.txt)"
+[ "$(cat batch.out)" = "$expected" ] || fail "wrong batch output: $(cat batch.out)"
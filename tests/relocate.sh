@@ -0,0 +1,22 @@
+# --project-root: plans survive moving the checkout, and depfiles written from a build
+# directory still name the inputs make should watch.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p a/src
+echo 'fn b() {}' > a/src/b.wgsl
+printf '#include "b.wgsl"\nfn main() {}\n' > a/src/e.wgsl
+./wp --project-root a a/src/e.wgsl a/out.wgsl
+mv a c
+./wp --project-root c --check c/out.wgsl || fail "the plan did not survive moving the checkout"
+echo 'fn b2() {}' > c/src/b.wgsl
+if ./wp --project-root c --check c/out.wgsl 2>/dev/null; then fail "a changed input went unnoticed after the move"; fi
+
+command -v make >/dev/null 2>&1 || skip "make is not installed"
+mkdir c/build
+cd c/build
+../../wp --project-root .. --depfile out.d c/src/e.wgsl out.wgsl
+printf 'out.wgsl:\n\ttouch out.wgsl\ninclude out.d\n' > Makefile
+make -q || fail "make cannot find the inputs listed in the depfile: $(cat out.d)"
+sleep 1
+touch ../src/b.wgsl
+if make -q; then fail "make did not pick up the changed include"; fi
@@ -0,0 +1,41 @@
+# --remote-cache: a hit is found without resolving, is evaluated against -D, and leaves a
+# plan behind for --check; damaged objects are ignored.
+. "$(dirname "$0")/common.sh"
+
+./wp --cache-server 127.0.0.1:$port --cache-dir server &
+background=$!
+for checkout in a b c; do
+    mkdir $checkout
+    echo 'fn x() {}' > $checkout/x.wgsl
+    printf '#include "x.wgsl"\n#ifdef A\nfn a() {}\n#endif\nfn main() {}\n' > $checkout/e.wgsl
+done
+expected=$(printf 'fn x() {}\nfn a() {}\nfn main() {}')
+
+# Build in a until the server has stored the manifest and the bundle (it may still be starting up)
+for attempt in 1 2 3 4 5 6 7 8 9 10; do
+    rm -f a/out.wgsl a/out.wgsl.plan
+    ./wp -D A --project-root a --remote-cache 127.0.0.1:$port a/e.wgsl a/out.wgsl 2>/dev/null
+    [ "$(ls server/remote 2>/dev/null | wc -l)" -ge 2 ] && break
+    sleep 0.2
+done
+[ "$(ls server/remote | wc -l)" -ge 2 ] || fail "the server did not store a manifest and a bundle"
+
+# A fetched bundle is kept in its plan as one literal, where a local build keeps only ranges
+./wp -D A --project-root b --remote-cache 127.0.0.1:$port b/e.wgsl b/out.wgsl
+[ "$(cat b/out.wgsl)" = "$expected" ] || fail "wrong output: $(cat b/out.wgsl)"
+grep -q 'fn a()' b/out.wgsl.plan || fail "the bundle was not fetched"
+./wp --project-root b -D A --check b/out.wgsl || fail "a fetched output is reported stale"
+rm b/out.wgsl
+./wp -D A --project-root b b/e.wgsl b/out.wgsl
+[ "$(cat b/out.wgsl)" = "$expected" ] || fail "replaying a fetched bundle gave: $(cat b/out.wgsl)"
+echo 'fn y() {}' > b/x.wgsl
+if ./wp -D A --project-root b --check b/out.wgsl 2>/dev/null; then fail "a changed input of a fetched output went unnoticed"; fi
+
+# A changed include does not match the manifest, so nothing stale is fetched
+./wp -D A --project-root b --remote-cache 127.0.0.1:$port b/e.wgsl b/out.wgsl
+grep -q 'fn y()' b/out.wgsl || fail "a stale bundle was fetched: $(cat b/out.wgsl)"
+
+for object in server/remote/*; do printf 'x' >> "$object"; done
+./wp -D A --project-root c --remote-cache 127.0.0.1:$port c/e.wgsl c/out.wgsl 2>errors.txt
+[ "$(cat c/out.wgsl)" = "$expected" ] || fail "wrong output with damaged objects: $(cat c/out.wgsl)"
+grep -q 'damaged' errors.txt || fail "a damaged object was accepted"
@@ -0,0 +1,35 @@
+# --residual: -D/-U defines are folded away, conditions on anything else are kept (simplified),
+# and evaluating the residual later gives what evaluating everything at once would have.
+. "$(dirname "$0")/common.sh"
+
+cat > a.wgsl <<'WGSL'
+#ifdef A
+fn a() {}
+#else
+fn notA() {}
+#endif
+#if defined(B) && defined(A)
+fn ab() {}
+#endif
+#ifdef C
+fn c() {}
+#endif
+#if X || defined(A)
+fn xa() {}
+#endif
+fn main() {}
+WGSL
+./wp --residual -D A -U C a.wgsl residual.wgsl || fail "preprocessor exited with $?"
+cat > expected.wgsl <<'WGSL'
+fn a() {}
+#if defined(B)
+fn ab() {}
+#endif
+fn xa() {}
+fn main() {}
+WGSL
+cmp -s residual.wgsl expected.wgsl || fail "unexpected residual: $(cat residual.wgsl)"
+
+./wp -D B residual.wgsl later.wgsl
+./wp -D A -D B -U C a.wgsl direct.wgsl
+cmp -s later.wgsl direct.wgsl || fail "the residual evaluates differently: $(cat later.wgsl)"
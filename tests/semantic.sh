@@ -0,0 +1,22 @@
+# --semantic-key: an edit to comments or whitespace only leaves the output and its key alone,
+# a real edit changes both.
+. "$(dirname "$0")/common.sh"
+
+printf 'fn b() {}\n' > b.wgsl
+printf '#include "b.wgsl"\nfn main() { let x = 1; }\n' > a.wgsl
+./wp --semantic-key a.wgsl out.wgsl
+[ -f out.wgsl.key ] || fail "no key was written"
+key=$(cat out.wgsl.key)
+stamp() { ls -l --full-time out.wgsl out.wgsl.key; }
+before=$(stamp)
+
+sleep 1
+printf '// helper\n\n  fn   b() {} /* block */\n' > b.wgsl
+./wp --semantic-key a.wgsl out.wgsl
+[ "$(cat out.wgsl.key)" = "$key" ] || fail "a cosmetic edit changed the key"
+[ "$(stamp)" = "$before" ] || fail "a cosmetic edit rewrote the output or its key"
+
+printf 'fn b() { return; }\n' > b.wgsl
+./wp --semantic-key a.wgsl out.wgsl
+[ "$(cat out.wgsl.key)" != "$key" ] || fail "a real edit kept the key"
+grep -q 'return;' out.wgsl || fail "a real edit was not written: $(cat out.wgsl)"
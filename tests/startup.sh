@@ -0,0 +1,11 @@
+# --bench-startup: every run preprocesses for real and leaves no plan behind, and --bench-log
+# gets one CSV row per invocation.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn a() {}' > a.wgsl
+before=$(ls -l --full-time /dev/null.plan 2>/dev/null || true)
+./wp --bench-startup 3 --bench-log runs.csv a.wgsl > report.txt || fail "the benchmark failed"
+grep -q '^startup over 3 runs' report.txt || fail "unexpected report: $(cat report.txt)"
+[ "$(ls -l --full-time /dev/null.plan 2>/dev/null || true)" = "$before" ] || fail "the runs wrote /dev/null.plan"
+[ "$(wc -l < runs.csv | tr -d ' ')" = 1 ] || fail "expected one CSV row: $(cat runs.csv)"
+[ "$(awk -F, '{ print $3 }' runs.csv)" = 3 ] || fail "the row does not record the run count: $(cat runs.csv)"
@@ -0,0 +1,43 @@
+# --serve --state: a restarted daemon resumes with the sources it had cached, but never serves
+# one that changed while it was down.
+. "$(dirname "$0")/common.sh"
+
+echo 'fn b() {}' > b.wgsl
+printf '#include "b.wgsl"\nfn main() {}\n' > a.wgsl
+
+serve()
+{
+    rm -f daemon.sock
+    ./wp --serve "$work/daemon.sock" --state "$work/state.bin" 2>>daemon.log &
+    daemon=$!
+    background=$daemon
+    for attempt in $(seq 50); do
+        [ -S daemon.sock ] && return
+        sleep 0.1
+    done
+    fail "the daemon did not start: $(cat daemon.log)"
+}
+
+stop()
+{
+    kill -TERM $daemon
+    wait $daemon || fail "the daemon did not stop cleanly"
+    background=""
+}
+
+serve
+./wp --connect "$work/daemon.sock" a.wgsl > first.wgsl || fail "the first request failed"
+stop
+[ -s state.bin ] || fail "no snapshot was saved on shutdown"
+
+serve
+grep -q 'Restored 2 cached sources' daemon.log || fail "the snapshot was not restored: $(cat daemon.log)"
+./wp --connect "$work/daemon.sock" a.wgsl > second.wgsl || fail "a request after the restart failed"
+cmp -s first.wgsl second.wgsl || fail "the restored daemon answered differently: $(cat second.wgsl)"
+stop
+
+echo 'fn b2() {}' > b.wgsl
+serve
+./wp --connect "$work/daemon.sock" a.wgsl > third.wgsl || fail "a request after an edit failed"
+grep -q 'fn b2()' third.wgsl || fail "a source changed while the daemon was down was served stale"
+stop
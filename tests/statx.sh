@@ -0,0 +1,25 @@
+# Batched stat: with enough inputs to be checked as one batch, an edit to any one of them,
+# even one that keeps its size, or its removal is still noticed; a bare touch is not an edit.
+. "$(dirname "$0")/common.sh"
+
+for i in $(seq 12); do
+    echo "fn f$i() {}" > part$i.wgsl
+    echo "#include \"part$i.wgsl\"" >> entry.wgsl
+done
+./wp entry.wgsl out.wgsl
+./wp --check out.wgsl || fail "a fresh output is reported stale"
+
+echo 'fn g7() {}' > part7.wgsl
+if ./wp --check out.wgsl 2>/dev/null; then fail "an edited input went unnoticed"; fi
+./wp entry.wgsl out.wgsl
+./wp --check out.wgsl || fail "a rebuilt output is reported stale"
+
+sleep 1
+touch part12.wgsl
+./wp --check out.wgsl || fail "a touched but unchanged input made the output stale"
+echo 'fn x12() {}' > part12.wgsl
+if ./wp --check out.wgsl 2>/dev/null; then fail "an edit keeping the size went unnoticed"; fi
+./wp entry.wgsl out.wgsl
+
+rm part3.wgsl
+if ./wp --check out.wgsl 2>/dev/null; then fail "a removed input went unnoticed"; fi
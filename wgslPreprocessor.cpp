@@ -2,15 +2,195 @@
 #include <fstream>      // For std::ifstream, std::ofstream
 #include <string>       // For std::string, std::getline
 #include <filesystem>   // For std::filesystem::path, std::filesystem::absolute, std::filesystem::canonical, etc.
-#include <map>          // For std::set to track active includes
+#include <map>
 #include <vector>
 #include <algorithm>
+#include <set>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <thread>
+#include <new>
+#include <cstdio>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <optional>
+#include <functional>
+#include <charconv>
+#include <cmath>
+#include <iomanip>
 
-// IMPORTANT: To compile with g++, you might need to use:
-// g++ preprocessor.cpp -o preprocessor -std=c++17 -lstdc++fs
-// (The -lstdc++fs flag might be needed on some Linux systems for filesystem support)
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+#ifdef WGSL_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef WGSL_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Memory accounting
+//
+// In builds with WGSL_MEMORY_STATS, global operator new/delete carry a small header recording
+// the size and the subsystem that was active (MemoryTagScope) when the block was allocated, so
+// --mem-stats can report allocation counts, bytes and peak usage per subsystem.
+// std::filesystem::path and friends allocate internally, which is why this hooks the global
+// allocator instead of containers. Other builds keep the standard allocator untouched.
+// ---------------------------------------------------------------------------
+
+enum class MemoryTag : uint8_t
+{
+    Other,
+    Paths,    // path construction and canonicalization
+    Sources,  // file contents and scanned #include names
+    Graph,    // the include map and its ordering
+    Output,   // assembled bundles
+    Count
+};
+
+const char *const memoryTagNames[] = {"other", "paths", "sources", "graph", "output"};
+
+struct MemoryCounters
+{
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> liveBytes{0};
+    std::atomic<uint64_t> peakBytes{0};
+};
+
+MemoryCounters memoryCounters[static_cast<size_t>(MemoryTag::Count)];
+thread_local MemoryTag currentMemoryTag = MemoryTag::Other;
+
+// Attributes allocations made on this thread to a subsystem until the scope ends.
+class MemoryTagScope
+{
+public:
+    explicit MemoryTagScope(MemoryTag tag) : previous(currentMemoryTag) { currentMemoryTag = tag; }
+    ~MemoryTagScope() { currentMemoryTag = previous; }
+    MemoryTagScope(const MemoryTagScope &) = delete;
+    MemoryTagScope &operator=(const MemoryTagScope &) = delete;
+
+private:
+    MemoryTag previous;
+};
+
+#ifdef WGSL_MEMORY_STATS
+
+struct alignas(16) AllocationHeader
+{
+    uint64_t size;
+    MemoryTag tag;
+};
+
+void *allocateTracked(std::size_t size) noexcept
+{
+    void *block = std::malloc(sizeof(AllocationHeader) + size);
+    if (block == nullptr) return nullptr;
+    AllocationHeader *header = static_cast<AllocationHeader *>(block);
+    header->size = size;
+    header->tag = currentMemoryTag;
+
+    MemoryCounters &counters = memoryCounters[static_cast<size_t>(header->tag)];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    uint64_t live = counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !counters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    {
+    }
+    return header + 1;
+}
+
+void freeTracked(void *pointer) noexcept
+{
+    if (pointer == nullptr) return;
+    AllocationHeader *header = static_cast<AllocationHeader *>(pointer) - 1;
+    memoryCounters[static_cast<size_t>(header->tag)].liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+void *operator new(std::size_t size)
+{
+    void *pointer = allocateTracked(size);
+    if (pointer == nullptr) throw std::bad_alloc();
+    return pointer;
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocateTracked(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocateTracked(size); }
+void operator delete(void *pointer) noexcept { freeTracked(pointer); }
+void operator delete[](void *pointer) noexcept { freeTracked(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { freeTracked(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { freeTracked(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { freeTracked(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { freeTracked(pointer); }
+
+#endif // WGSL_MEMORY_STATS
+
+void printMemoryStats(std::ostream &out)
+{
+#ifdef WGSL_MEMORY_STATS
+    out << "subsystem      allocations           bytes      live bytes      peak bytes\n";
+    for (size_t i = 0; i < static_cast<size_t>(MemoryTag::Count); i++)
+    {
+        const MemoryCounters &counters = memoryCounters[i];
+        char row[128];
+        std::snprintf(row, sizeof(row), "%-10s %15llu %15llu %15llu %15llu\n", memoryTagNames[i],
+                      static_cast<unsigned long long>(counters.allocations.load(std::memory_order_relaxed)),
+                      static_cast<unsigned long long>(counters.bytes.load(std::memory_order_relaxed)),
+                      static_cast<unsigned long long>(counters.liveBytes.load(std::memory_order_relaxed)),
+                      static_cast<unsigned long long>(counters.peakBytes.load(std::memory_order_relaxed)));
+        out << row;
+    }
+#else
+    out << "--mem-stats is not available in this build (configure with WGSL_MEMORY_STATS)\n";
+#endif
+}
 
 std::vector<std::filesystem::path> convertActiveIncludesToVector(std::map<std::filesystem::path, uint32_t> map) {
+    MemoryTagScope memoryTag(MemoryTag::Graph);
     // 1. Create a vector of pairs (value, key)
     //    We put value (uint32_t) first to easily sort by value.
     //    std::pair<uint32_t, std::filesystem::path>
@@ -21,8 +201,9 @@ std::vector<std::filesystem::path> convertActiveIncludesToVector(std::map<std::f
         valueKeyPairs.push_back({pair.second, pair.first}); // {value, key}
     }
 
-    // 2. Sort the vector of pairs by value in descending order
-    std::sort(valueKeyPairs.begin(), valueKeyPairs.end(),
+    // 2. Sort the vector of pairs by value in descending order; ties stay in path order so the
+    //    bundle is the same on every standard library (and matches wgslPreprocessorConsteval.hpp)
+    std::stable_sort(valueKeyPairs.begin(), valueKeyPairs.end(),
               [](const std::pair<uint32_t, std::filesystem::path>& a, const std::pair<uint32_t, std::filesystem::path>& b) {
                   // Sort by value (first element of the pair) in descending order
                   return a.first > b.first;
@@ -48,185 +229,6343 @@ void removeDot(std::filesystem::path& absoluteIncludedPath) {
     }
 }
 
+// 64-bit MurmurHash2 (MurmurHash64A) of a byte range, reading 8-byte blocks little-endian.
+uint64_t hashBytes(std::string_view data, uint64_t seed = 0)
+{
+    const uint64_t multiplier = 0xc6a4a7935bd1e995ULL;
+    const int shift = 47;
+    uint64_t hash = seed ^ (data.size() * multiplier);
+
+    size_t blockEnd = data.size() & ~size_t(7);
+    for (size_t i = 0; i < blockEnd; i += 8)
+    {
+        uint64_t block;
+        std::memcpy(&block, data.data() + i, sizeof(block));
+        block *= multiplier;
+        block ^= block >> shift;
+        block *= multiplier;
+        hash ^= block;
+        hash *= multiplier;
+    }
+    if (data.size() & 7)
+    {
+        for (size_t i = data.size() & 7; i > 0; i--)
+        {
+            hash ^= uint64_t(static_cast<unsigned char>(data[blockEnd + i - 1])) << (8 * (i - 1));
+        }
+        hash *= multiplier;
+    }
+    hash ^= hash >> shift;
+    hash *= multiplier;
+    hash ^= hash >> shift;
+    return hash;
+}
+
+// Identifies one version of a file on disk: if none of these fields changed, neither did the contents.
+struct FileIdentity
+{
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t modifiedNs = 0;
+
+    bool operator==(const FileIdentity &other) const = default;
+};
+
+bool statFileIdentity(const std::filesystem::path &filePath, FileIdentity &identity)
+{
+#ifdef _WIN32
+    std::error_code error;
+    identity.size = std::filesystem::file_size(filePath, error);
+    if (error) return false;
+    identity.modifiedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::filesystem::last_write_time(filePath, error).time_since_epoch()).count();
+    return !error;
+#else
+    struct stat status;
+    if (stat(filePath.c_str(), &status) != 0) return false;
+    identity.device = static_cast<uint64_t>(status.st_dev);
+    identity.inode = static_cast<uint64_t>(status.st_ino);
+    identity.size = static_cast<uint64_t>(status.st_size);
+    identity.modifiedNs = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+    return true;
+#endif
+}
+
+// A member of an --archive has no identity of its own on disk. "lib.tar/common/math.wgsl" takes
+// lib.tar's identity with the member name mixed into the inode: it changes whenever the archive
+// does, and differs between members.
+FileIdentity archiveMemberIdentity(FileIdentity archiveIdentity, std::string_view memberName)
+{
+    archiveIdentity.inode ^= hashBytes(memberName);
+    return archiveIdentity;
+}
+
+bool isArchivePath(const std::filesystem::path &filePath)
+{
+    std::filesystem::path extension = filePath.extension();
+    return extension == ".tar" || extension == ".zip";
+}
+
+// "gen:<name>?<args>" names generated text (see GeneratorProvider), not a place on disk.
+bool isGeneratedPath(std::string_view name)
+{
+    return name.rfind("gen:", 0) == 0;
+}
+
+// Generated text has no file behind it: it is identified by the generator name and arguments
+// alone. Generators are assumed to be pure; their commands are part of every plan key.
+FileIdentity generatedIdentity(std::string_view name)
+{
+    FileIdentity identity;
+    identity.inode = hashBytes(name);
+    return identity;
+}
+
+bool readFileIdentity(const std::filesystem::path &filePath, FileIdentity &identity)
+{
+    if (isGeneratedPath(filePath.native()))
+    {
+        identity = generatedIdentity(filePath.native());
+        return true;
+    }
+    if (statFileIdentity(filePath, identity)) return true;
+    for (std::filesystem::path archive = filePath.parent_path(); archive.has_relative_path(); archive = archive.parent_path())
+    {
+        if (!isArchivePath(archive)) continue;
+        FileIdentity archiveIdentity;
+        if (!statFileIdentity(archive, archiveIdentity)) return false;
+        identity = archiveMemberIdentity(archiveIdentity, std::string_view(filePath.native()).substr(archive.native().size() + 1));
+        return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+
+FileIdentity identityFromStatx(const struct statx &status)
+{
+    FileIdentity identity;
+    identity.device = static_cast<uint64_t>(makedev(status.stx_dev_major, status.stx_dev_minor));
+    identity.inode = status.stx_ino;
+    identity.size = status.stx_size;
+    identity.modifiedNs = static_cast<int64_t>(status.stx_mtime.tv_sec) * 1000000000 + status.stx_mtime.tv_nsec;
+    return identity;
+}
+
 /**
- * @brief Preprocesses a text file, handling #include directives with relative path resolution and circular include detection.
- *
- * This function reads the content of a file. If it encounters a line
- * starting with "#include \"<filename>\"", it resolves <filename> relative to
- * currentBaseDir, recursively processes the included file, and inserts its content.
- * It detects and reports circular include dependencies to prevent infinite recursion.
+ * @brief Minimal io_uring used to submit many statx calls with a single system call.
  *
- * @param filePath The absolute path to the file currently being processed.
- * @param currentBaseDir The directory from which relative #include paths within filePath
- * should be resolved.
- * @param outputStream The output stream where the preprocessed content will be written.
- * @param activeIncludes A set tracking the absolute paths of files currently in the include stack.
- * @return True if preprocessing was successful for the given file, false otherwise.
+ * Talks to the kernel directly (no liburing). If the kernel or a seccomp filter refuses
+ * io_uring_setup, open() fails and callers fall back to plain statx.
  */
-bool findIncludes(const std::filesystem::path &filePath,
-                    const std::filesystem::path &currentBaseDir,
-                    std::map<std::filesystem::path, uint32_t> &activeIncludes,
-                    uint32_t depth )
-{ 
-    try {
-        if(activeIncludes.at(filePath) < depth) {
-            activeIncludes.insert_or_assign(filePath, depth);
-            return true; //skip finding includes since we have already done it on this file
-        }
-    }
-    catch (std::exception e)
+class StatxRing
+{
+public:
+    StatxRing() = default;
+    StatxRing(const StatxRing &) = delete;
+    StatxRing &operator=(const StatxRing &) = delete;
+
+    ~StatxRing()
     {
-        activeIncludes[filePath] = depth;
+        if (submissionEntries != nullptr) munmap(submissionEntries, submissionEntriesSize);
+        if (completionRing != nullptr && completionRing != submissionRing) munmap(completionRing, completionRingSize);
+        if (submissionRing != nullptr) munmap(submissionRing, submissionRingSize);
+        if (ringDescriptor >= 0) close(ringDescriptor);
     }
-    std::ifstream inputFile(filePath); // Open the file using its absolute path
-    if (!inputFile.is_open())
+
+    bool open(unsigned entries)
     {
-        std::cerr << "Error: Could not open file: " << filePath << std::endl;
-        activeIncludes.erase(filePath);
-        return false;
+        io_uring_params parameters{};
+        ringDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, entries, &parameters));
+        if (ringDescriptor < 0) return false;
+
+        submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+        completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+        bool singleMapping = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMapping)
+        {
+            submissionRingSize = completionRingSize = std::max(submissionRingSize, completionRingSize);
+        }
+        submissionRing = mapRing(submissionRingSize, IORING_OFF_SQ_RING);
+        completionRing = singleMapping ? submissionRing : mapRing(completionRingSize, IORING_OFF_CQ_RING);
+        submissionEntriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+        submissionEntries = static_cast<io_uring_sqe *>(mapRing(submissionEntriesSize, IORING_OFF_SQES));
+        if (submissionRing == nullptr || completionRing == nullptr || submissionEntries == nullptr) return false;
+
+        char *sq = static_cast<char *>(submissionRing);
+        char *cq = static_cast<char *>(completionRing);
+        submissionTail = reinterpret_cast<unsigned *>(sq + parameters.sq_off.tail);
+        submissionMask = *reinterpret_cast<unsigned *>(sq + parameters.sq_off.ring_mask);
+        submissionArray = reinterpret_cast<unsigned *>(sq + parameters.sq_off.array);
+        completionHead = reinterpret_cast<unsigned *>(cq + parameters.cq_off.head);
+        completionTail = reinterpret_cast<unsigned *>(cq + parameters.cq_off.tail);
+        completionMask = *reinterpret_cast<unsigned *>(cq + parameters.cq_off.ring_mask);
+        completions = reinterpret_cast<io_uring_cqe *>(cq + parameters.cq_off.cqes);
+        capacity = parameters.sq_entries;
+        return true;
     }
 
-    std::string line;
-    uint32_t nothingFoundCount = 0; //includes should be near the top
-    while (std::getline(inputFile, line) && nothingFoundCount < 5)
+    // Runs statx for paths[first, first + count), count <= capacity, normally with one submit.
+    // Returns false if not every entry could be submitted; the caller then stats the files itself.
+    bool statxBatch(const std::vector<std::string> &paths, size_t first, size_t count, std::vector<struct statx> &results, std::vector<int> &errors)
     {
-        const std::string include_directive_prefix = "#include \"";
-        if (line.rfind(include_directive_prefix, 0) == 0)
-        { // Check if line starts with the prefix
-            size_t start_quote_pos = include_directive_prefix.length();
-            size_t end_quote_pos = line.find('"', start_quote_pos);
+        unsigned tail = *submissionTail;
+        for (size_t i = 0; i < count; i++)
+        {
+            unsigned index = tail & submissionMask;
+            io_uring_sqe &entry = submissionEntries[index];
+            std::memset(&entry, 0, sizeof(entry));
+            entry.opcode = IORING_OP_STATX;
+            entry.fd = AT_FDCWD;
+            entry.addr = reinterpret_cast<uint64_t>(paths[first + i].c_str());
+            entry.len = STATX_BASIC_STATS;
+            entry.off = reinterpret_cast<uint64_t>(&results[first + i]);
+            entry.user_data = first + i;
+            submissionArray[index] = index;
+            tail++;
+        }
+        __atomic_store_n(submissionTail, tail, __ATOMIC_RELEASE);
 
-            if (end_quote_pos != std::string::npos)
+        // The kernel may consume fewer entries than offered; the rest stay queued, so offer
+        // them again. If it stops taking any, give up on the ring once the submitted
+        // entries have completed: they write into results, so they must not be left behind.
+        unsigned submitted = 0;
+        while (submitted < count)
+        {
+            long entered = syscall(__NR_io_uring_enter, ringDescriptor, static_cast<unsigned>(count) - submitted, 0, 0, nullptr, 0);
+            if (entered < 0 && errno == EINTR) continue;
+            if (entered <= 0) break;
+            submitted += static_cast<unsigned>(entered);
+        }
+
+        unsigned head = *completionHead;
+        unsigned received = 0;
+        while (received < submitted)
+        {
+            unsigned available = __atomic_load_n(completionTail, __ATOMIC_ACQUIRE);
+            if (head == available)
             {
-                std::string includedRelativeFileName = line.substr(start_quote_pos, end_quote_pos - start_quote_pos);
-                std::filesystem::path absoluteIncludedPath = currentBaseDir / includedRelativeFileName;
-                removeDot(absoluteIncludedPath);
-                std::filesystem::path nextBaseDir = absoluteIncludedPath.parent_path();
-                if (!findIncludes(absoluteIncludedPath, nextBaseDir, activeIncludes, depth + 1))
+                if (syscall(__NR_io_uring_enter, ringDescriptor, 0, submitted - received, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR)
                 {
-                    inputFile.close();
-                    activeIncludes.erase(filePath); // Manual cleanup on error
                     return false;
                 }
-                nothingFoundCount = 0;
-            }
-            else
-            {
-                std::cerr << "Warning: Malformed #include directive in " << filePath << ": " << line << std::endl;
+                continue;
             }
+            const io_uring_cqe &completion = completions[head & completionMask];
+            errors[completion.user_data] = completion.res < 0 ? -completion.res : 0;
+            head++;
+            received++;
         }
-        else
+        __atomic_store_n(completionHead, head, __ATOMIC_RELEASE);
+        return submitted == count;
+    }
+
+    unsigned capacity = 0;
+
+private:
+    void *mapRing(size_t size, off_t offset)
+    {
+        void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, offset);
+        return address == MAP_FAILED ? nullptr : address;
+    }
+
+    int ringDescriptor = -1;
+    void *submissionRing = nullptr;
+    void *completionRing = nullptr;
+    io_uring_sqe *submissionEntries = nullptr;
+    size_t submissionRingSize = 0;
+    size_t completionRingSize = 0;
+    size_t submissionEntriesSize = 0;
+    unsigned *submissionTail = nullptr;
+    unsigned submissionMask = 0;
+    unsigned *submissionArray = nullptr;
+    unsigned *completionHead = nullptr;
+    unsigned *completionTail = nullptr;
+    unsigned completionMask = 0;
+    io_uring_cqe *completions = nullptr;
+};
+
+#endif // __linux__
+
+/**
+ * @brief Stats many files in one pass.
+ *
+ * On Linux every file's statx is queued on an io_uring and submitted in batches of up to 256,
+ * so checking a whole shader tree costs a handful of system calls rather than one per file.
+ * Directory mtimes are not a usable shortcut: editing a file in place leaves its directory
+ * untouched. Where io_uring is unavailable the files are stat'ed one by one, as is any file
+ * whose queued statx failed with something other than ENOENT.
+ *
+ * @param files The files to stat.
+ * @param identities Receives each file's current identity.
+ * @return For each file, whether it exists.
+ */
+std::vector<bool> readFileIdentities(const std::vector<std::filesystem::path> &files, std::vector<FileIdentity> &identities)
+{
+    std::vector<bool> found(files.size(), false);
+    identities.assign(files.size(), FileIdentity());
+#ifdef __linux__
+    const size_t batchThreshold = 8; // below this, setting up the ring costs more than it saves
+    if (files.size() >= batchThreshold)
+    {
+        std::vector<std::string> paths;
+        paths.reserve(files.size());
+        for (const auto &filePath : files)
+        {
+            paths.push_back(filePath.string());
+        }
+        std::vector<struct statx> results(files.size());
+        std::vector<int> errors(files.size(), 0);
+        StatxRing ring;
+        bool batched = ring.open(static_cast<unsigned>(std::min<size_t>(files.size(), 256)));
+        for (size_t first = 0; batched && first < files.size(); first += ring.capacity)
         {
-            nothingFoundCount++;
+            batched = ring.statxBatch(paths, first, std::min<size_t>(ring.capacity, files.size() - first), results, errors);
+        }
+        if (batched)
+        {
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                if (errors[i] == 0 && !isGeneratedPath(paths[i]))
+                {
+                    found[i] = true;
+                    identities[i] = identityFromStatx(results[i]);
+                }
+                else if (errors[i] != ENOENT || isGeneratedPath(paths[i]))
+                {
+                    // EINVAL/EOPNOTSUPP from kernels without IORING_OP_STATX, EAGAIN, ...: only a
+                    // definite "no such file" counts as missing. ENOTDIR may be an archive member.
+                    found[i] = readFileIdentity(files[i], identities[i]);
+                }
+            }
+            return found;
         }
     }
+#endif
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        found[i] = readFileIdentity(files[i], identities[i]);
+    }
+    return found;
+}
+
+/**
+ * @brief Checks recorded identities against the filesystem in one pass.
+ *
+ * @param files The files to check.
+ * @param identities The identity recorded for each file.
+ * @return For each file, whether it still has the recorded identity.
+ */
+std::vector<bool> validateFileIdentities(const std::vector<std::filesystem::path> &files,
+                                         const std::vector<FileIdentity> &identities)
+{
+    std::vector<FileIdentity> current;
+    std::vector<bool> unchanged = readFileIdentities(files, current);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        unchanged[i] = unchanged[i] && current[i] == identities[i];
+    }
+    return unchanged;
+}
+
+// Reads a file into text; the identity comes from the same descriptor, so it matches the bytes read.
+bool readWholeFile(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity)
+{
+#ifdef _WIN32
+    std::ifstream inputFile(filePath, std::ios::binary);
+    if (!inputFile.is_open() || !readFileIdentity(filePath, identity)) return false;
+    text.assign(std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>());
+    return true;
+#else
+    int descriptor = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) return false;
+    struct stat status;
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        return false;
+    }
+    identity.device = static_cast<uint64_t>(status.st_dev);
+    identity.inode = static_cast<uint64_t>(status.st_ino);
+    identity.size = static_cast<uint64_t>(status.st_size);
+    identity.modifiedNs = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
 
-    inputFile.close();
+    text.resize(identity.size);
+    size_t total = 0;
+    while (total < text.size())
+    {
+        ssize_t received = read(descriptor, text.data() + total, text.size() - total);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) break;
+        total += static_cast<size_t>(received);
+    }
+    text.resize(total);
+    close(descriptor);
     return true;
+#endif
 }
 
-int main(int argc, char *argv[])
+/**
+ * @brief Writes data to a file, or to stdout when outputFile is empty, with as few calls as possible.
+ *
+ * @return True if everything was written.
+ */
+bool writeWholeFile(const std::string &outputFile, const std::string &data)
 {
-    if (argc < 2 || argc > 3)
+#ifdef _WIN32
+    if (outputFile.empty())
     {
-        std::cerr << "Usage: " << argv[0] << " <input_file> [output_file]" << std::endl;
-        return 1; // Indicate error
+        std::cout.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return std::cout.good();
     }
+    std::ofstream file(outputFile);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return file.good();
+#else
+    struct stat existing;
+    if (!outputFile.empty() && ::stat(outputFile.c_str(), &existing) == 0 && S_ISREG(existing.st_mode) && existing.st_nlink > 1)
+    {
+        ::unlink(outputFile.c_str()); // shared with another output by --dedup-outputs; never write through it
+    }
+    int descriptor = outputFile.empty() ? STDOUT_FILENO : ::open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (descriptor < 0) return false;
+    const char *cursor = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0)
+    {
+        ssize_t written = write(descriptor, cursor, remaining);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        cursor += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    if (descriptor != STDOUT_FILENO) close(descriptor);
+    return remaining == 0;
+#endif
+}
 
-    // It's good practice to untie C++ streams from C stdio for performance,
-    // though not strictly necessary for correctness here.
-    std::ios_base::sync_with_stdio(false);
-    std::cin.tie(NULL);
+// Writes next to the target and renames, so readers never see a half-written file.
+bool writeFileAtomically(const std::filesystem::path &filePath, std::string_view data)
+{
+    // Unique per process and call, so concurrent writers of one path (processes sharing a
+    // --cache-dir) never write into each other's temporary file
+    static std::atomic<uint32_t> temporaryCount{0};
+    std::filesystem::path temporaryPath = filePath;
+#ifdef _WIN32
+    temporaryPath += ".tmp" + std::to_string(_getpid()) + "." + std::to_string(temporaryCount++);
+#else
+    temporaryPath += ".tmp" + std::to_string(getpid()) + "." + std::to_string(temporaryCount++);
+#endif
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file.good())
+        {
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, filePath, error);
+    return !error;
+}
 
-    // 1. Determine the directory of the executable
-    std::filesystem::path executablePath = std::filesystem::absolute(argv[0]);
-    std::filesystem::path programBaseDir = executablePath.parent_path(); // This is the executable's directory
+// Read-only view of a whole file; memory-mapped where the platform allows it.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
 
-    // 2. Resolve the input file path relative to the executable's directory
-    std::filesystem::path inputFilePathArgument(argv[1]);
-    std::filesystem::path absoluteInitialFilePath = programBaseDir / inputFilePathArgument;
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (mapping != nullptr) munmap(mapping, length);
+#endif
+    }
 
-    // Normalize the absolute initial file path to remove redundant '.' or '..'
-    try
+    bool open(const std::filesystem::path &filePath)
     {
-        absoluteInitialFilePath = std::filesystem::canonical(absoluteInitialFilePath);
+#ifdef _WIN32
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file.is_open()) return false;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        length = buffer.size();
+        return true;
+#else
+        int descriptor = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0) return false;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0)
+        {
+            close(descriptor);
+            return false;
+        }
+        length = static_cast<size_t>(status.st_size);
+        if (length > 0)
+        {
+            void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (address == MAP_FAILED)
+            {
+                close(descriptor);
+                return false;
+            }
+            mapping = address;
+        }
+        close(descriptor);
+        return true;
+#endif
     }
-    catch (const std::filesystem::filesystem_error &e)
+
+    const char *data() const
     {
-        std::cerr << "Error resolving canonical path for initial input file: " << argv[1] << std::endl;
-        std::cerr << "Filesystem error: " << e.what() << std::endl;
-        return 1;
+#ifdef _WIN32
+        return buffer.data();
+#else
+        return static_cast<const char *>(mapping);
+#endif
     }
 
-    // The base directory for resolving includes *within* the initial file
-    std::filesystem::path initialFileProcessingBaseDir = absoluteInitialFilePath.parent_path();
+    size_t size() const { return length; }
 
-    // --- Initialize the activeIncludes set ---
-    // This set will be passed by reference to all recursive calls.
-    std::map<std::filesystem::path, uint32_t> activeIncludes;
-    // -----------------------------------------
+private:
+#ifdef _WIN32
+    std::string buffer;
+#else
+    void *mapping = nullptr;
+#endif
+    size_t length = 0;
+};
+
+// Resolved state of a "precompiled prefix" entry: the files it pulls in and the bytes they emit.
+// Entries that reach any of these files start from the snapshot instead of rescanning them.
+struct PrefixSnapshot
+{
+    std::map<std::filesystem::path, FileIdentity> files;
+    std::filesystem::path snapshotPath;
+    FileIdentity snapshotIdentity;
+    std::string_view bundle;
+    MappedFile mapping;
+    bool reached = false; // set by findIncludes() when the entry includes a prefix file
+};
 
-    //std::cout << "Executable's folder: " << programBaseDir << std::endl;
-    //std::cout << "Starting preprocessing for: " << absoluteInitialFilePath << std::endl;
-    //std::cout << "Base directory for initial file's includes: " << initialFileProcessingBaseDir << std::endl;
+// A source of file contents other than plain files on disk. The SourceCache asks its providers,
+// in the order they were added, before falling back to the filesystem.
+class SourceProvider
+{
+public:
+    virtual ~SourceProvider() = default;
 
-    // Pass the activeIncludes set to the preprocessing function
-    if (!findIncludes(absoluteInitialFilePath, initialFileProcessingBaseDir, activeIncludes, 0))
-    {
-        std::cerr << "findIncludes failed." << std::endl;
-    } 
-    //else {
-    //    std::cout << "findIncludes completed successfully." << std::endl;
-    //}
+    virtual bool provides(const std::filesystem::path &filePath) const = 0;
+
+    // Reads the whole file; the identity changes whenever the contents may have.
+    virtual bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity) = 0;
+
+    // The current identity without reading, to revalidate cached text. Returning false keeps the
+    // cached text for the life of the cache.
+    virtual bool identify(const std::filesystem::path &, FileIdentity &) { return false; }
+
+    // The files on disk whose changes can change this one's contents, for depfiles.
+    virtual std::vector<std::filesystem::path> backingFiles(const std::filesystem::path &filePath) { return {filePath}; }
+};
+
+/**
+ * @brief Serves computed includes: "#include \"gen:lights?count=8\"" calls the generator
+ * registered as "lights" with the argument string "count=8".
+ *
+ * Each name and argument string is generated once per provider, so once per process, batch or
+ * daemon. Generated text goes through the same scanning, ordering and emission as files. Like
+ * any file it is scanned and emitted once per entry, so its own relative #includes resolve
+ * against the directory of the first file that includes it; generators shared between
+ * directories should only include by paths that resolve the same from all of them.
+ */
+class GeneratorProvider : public SourceProvider
+{
+public:
+    using Generator = std::function<bool(std::string_view arguments, std::string &text)>;
 
-    std::ofstream outputFile;
-    std::ostream *outputPtr = &std::cout; // Default to stdout
+    static bool isGeneratedPath(std::string_view name) { return ::isGeneratedPath(name); }
 
-    if (argc == 3)
+    void add(const std::string &name, Generator generator) { generators[name] = std::move(generator); }
+
+    bool provides(const std::filesystem::path &filePath) const override { return isGeneratedPath(filePath.native()); }
+
+    bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity) override
     {
-        std::string outputFilePathStr = argv[2];
-        outputFile.open(outputFilePathStr);
-        if (!outputFile.is_open())
+        std::string path = filePath.string();
+        std::lock_guard<std::mutex> lock(mutex); // so concurrent pipeline stages never run one twice
+        auto memoized = results.find(path);
+        if (memoized == results.end())
         {
-            std::cerr << "Error: Could not open output file: " << outputFilePathStr << std::endl;
-            return 1;
+            size_t question = path.find('?');
+            std::string name = path.substr(4, question == std::string::npos ? std::string::npos : question - 4);
+            std::string_view arguments = question == std::string::npos ? std::string_view() : std::string_view(path).substr(question + 1);
+            auto generator = generators.find(name);
+            std::string generated;
+            if (generator == generators.end())
+            {
+                std::cerr << "Error: No generator registered for: " << path << std::endl;
+                return false;
+            }
+            if (!generator->second(arguments, generated))
+            {
+                std::cerr << "Error: Generator failed: " << path << std::endl;
+                return false;
+            }
+            memoized = results.emplace(path, std::move(generated)).first;
         }
-        outputPtr = &outputFile; // Point to the output file stream
+        text = memoized->second;
+        identity = generatedIdentity(path);
+        return true;
     }
 
-    std::vector<std::filesystem::path> includes = convertActiveIncludesToVector(activeIncludes);
+    std::vector<std::filesystem::path> backingFiles(const std::filesystem::path &) override { return {}; }
 
-     // TODO Append contents of the files in the includes vector to the outputPtr
-    // Iterate through each file path in the 'includes' vector
-    for (const auto& filePath : includes)
+private:
+    std::map<std::string, Generator> generators;
+    std::map<std::string, std::string> results;
+    std::mutex mutex;
+};
+
+/**
+ * @brief Serves the members of a .tar or .zip archive as if it were a directory.
+ *
+ * With --archive lib.zip, "lib.zip/common/math.wgsl" names a member, as an input or through
+ * relative includes. The archive is mapped once and indexed on first use; stored members are
+ * copied straight from the mapping, deflated zip members are inflated (needs zlib). When the
+ * archive changes on disk, the index is rebuilt. Members carry archiveMemberIdentity(), which
+ * readFileIdentity() derives from one stat of the archive, so plans and --check revalidate them
+ * without opening it.
+ */
+class ArchiveProvider : public SourceProvider
+{
+public:
+    explicit ArchiveProvider(std::filesystem::path archivePath) : archivePath(std::move(archivePath)) {}
+
+    bool provides(const std::filesystem::path &filePath) const override
     {
-        std::ifstream inputFile(filePath); // Open the input file
-        if (!inputFile.is_open())
-        // Check if the input file was opened successfully
-        {
-            std::cerr << "Error: Could not open input file: " << filePath << std::endl;
-            continue; // Skip to the next file if this one can't be opened
-        }
+        const std::string &path = filePath.native();
+        const std::string &archive = archivePath.native();
+        return path.size() > archive.size() + 1 && path.compare(0, archive.size(), archive) == 0 && path[archive.size()] == '/';
+    }
+
+    bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!refresh()) return false;
+        auto member = members.find(memberName(filePath));
+        if (member == members.end()) return false;
+        if (!extract(member->second, text)) return false;
+        identity = archiveMemberIdentity(archiveIdentity, member->first);
+        return true;
+    }
+
+    bool identify(const std::filesystem::path &filePath, FileIdentity &identity) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!refresh()) return false;
+        auto member = members.find(memberName(filePath));
+        if (member == members.end()) return false;
+        identity = archiveMemberIdentity(archiveIdentity, member->first);
+        return true;
+    }
+
+    std::vector<std::filesystem::path> backingFiles(const std::filesystem::path &) override { return {archivePath}; }
+
+private:
+    struct Member
+    {
+        uint64_t offset;         // of the member's data in the archive
+        uint64_t storedSize;     // bytes in the archive
+        uint64_t size;           // bytes once extracted
+        bool deflated;
+    };
 
-        std::string line;
-        // Read the input file line by line
-        while (std::getline(inputFile, line))
+    std::string memberName(const std::filesystem::path &filePath) const
+    {
+        return filePath.native().substr(archivePath.native().size() + 1);
+    }
+
+    // Maps and indexes the archive unless the index is still current.
+    bool refresh()
+    {
+        FileIdentity identity;
+        if (!readFileIdentity(archivePath, identity)) return false;
+        if (indexed && identity == archiveIdentity) return true;
+
+        members.clear();
+        mapping = std::make_unique<MappedFile>();
+        if (!mapping->open(archivePath)) return false;
+        std::string extension = archivePath.extension().string();
+        bool valid = extension == ".zip" ? indexZip() : indexTar();
+        if (!valid)
         {
-            // Check if the line contains "#include"
-            if (line.find("#include") == std::string::npos)
-            {
-                // If it doesn't contain "#include", write the line to the output stream
-                *outputPtr << line << std::endl;
-            }
+            std::cerr << "Error: Could not read archive: " << archivePath << std::endl;
+            return false;
         }
-
-        inputFile.close(); // Close the input file after reading
+        archiveIdentity = identity;
+        indexed = true;
+        return true;
     }
 
-    if (outputFile.is_open())
+    static std::string normalizeName(std::string name)
     {
-        outputFile.close();
+        while (name.rfind("./", 0) == 0) name.erase(0, 2);
+        return std::filesystem::path(name).lexically_normal().generic_string();
     }
 
-    return 0; // Indicate success
-}
\ No newline at end of file
+    bool indexTar()
+    {
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(mapping->data());
+        uint64_t size = mapping->size();
+        std::string longName; // from a GNU 'L' or pax 'x' header, applies to the next member
+        for (uint64_t offset = 0; offset + 512 <= size;)
+        {
+            const char *header = reinterpret_cast<const char *>(data + offset);
+            if (header[0] == '\0') break; // end-of-archive blocks
+            uint64_t memberSize = parseOctal(header + 124, 12);
+            uint64_t dataOffset = offset + 512;
+            if (dataOffset + memberSize > size) return false;
+            char type = header[156];
+
+            std::string name = longName;
+            longName.clear();
+            if (name.empty())
+            {
+                name.assign(header, strnlen(header, 100));
+                if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0')
+                {
+                    name = std::string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+                }
+            }
+
+            if (type == 'L')
+            {
+                longName.assign(reinterpret_cast<const char *>(data + dataOffset), strnlen(reinterpret_cast<const char *>(data + dataOffset), memberSize));
+            }
+            else if (type == 'x')
+            {
+                longName = paxPath(std::string_view(reinterpret_cast<const char *>(data + dataOffset), memberSize));
+            }
+            else if (type == '0' || type == '\0')
+            {
+                members[normalizeName(name)] = {dataOffset, memberSize, memberSize, false};
+            }
+            offset = dataOffset + (memberSize + 511) / 512 * 512;
+        }
+        return true;
+    }
+
+    static uint64_t parseOctal(const char *field, size_t length)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+        {
+            value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+        }
+        return value;
+    }
+
+    // Pax records are "<length> <key>=<value>\n"; only path matters here.
+    static std::string paxPath(std::string_view records)
+    {
+        while (!records.empty())
+        {
+            size_t space = records.find(' ');
+            if (space == std::string_view::npos) break;
+            size_t length = std::strtoull(std::string(records.substr(0, space)).c_str(), nullptr, 10);
+            if (length <= space || length > records.size()) break;
+            std::string_view record = records.substr(space + 1, length - space - 2);
+            if (record.rfind("path=", 0) == 0) return std::string(record.substr(5));
+            records.remove_prefix(length);
+        }
+        return std::string();
+    }
+
+    static uint32_t littleEndian(const unsigned char *bytes, size_t count)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < count; i++) value |= uint32_t(bytes[i]) << (8 * i);
+        return value;
+    }
+
+    bool indexZip()
+    {
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(mapping->data());
+        uint64_t size = mapping->size();
+        if (size < 22) return false;
+
+        // The end-of-central-directory record sits in the last 64 KiB + 22 bytes
+        uint64_t end = size - 22;
+        uint64_t searchStart = size > 65557 ? size - 65557 : 0;
+        while (littleEndian(data + end, 4) != 0x06054b50)
+        {
+            if (end == searchStart) return false;
+            end--;
+        }
+        uint64_t entries = littleEndian(data + end + 10, 2);
+        uint64_t directoryOffset = littleEndian(data + end + 16, 4);
+        if (directoryOffset == 0xffffffff) return false; // zip64 is not supported
+
+        uint64_t offset = directoryOffset;
+        for (uint64_t entry = 0; entry < entries; entry++)
+        {
+            if (offset + 46 > size || littleEndian(data + offset, 4) != 0x02014b50) return false;
+            uint32_t method = littleEndian(data + offset + 10, 2);
+            uint64_t storedSize = littleEndian(data + offset + 20, 4);
+            uint64_t memberSize = littleEndian(data + offset + 24, 4);
+            uint32_t nameLength = littleEndian(data + offset + 28, 2);
+            uint32_t extraLength = littleEndian(data + offset + 30, 2);
+            uint32_t commentLength = littleEndian(data + offset + 32, 2);
+            uint64_t localHeader = littleEndian(data + offset + 42, 4);
+            if (offset + 46 + nameLength > size || localHeader + 30 > size) return false;
+            std::string name(reinterpret_cast<const char *>(data + offset + 46), nameLength);
+            offset += 46 + nameLength + extraLength + commentLength;
+
+            uint64_t dataOffset = localHeader + 30 + littleEndian(data + localHeader + 26, 2) + littleEndian(data + localHeader + 28, 2);
+            if (name.empty() || name.back() == '/' || (method != 0 && method != 8)) continue;
+            if (dataOffset + storedSize > size) return false;
+            members[normalizeName(name)] = {dataOffset, storedSize, memberSize, method == 8};
+        }
+        return true;
+    }
+
+    bool extract(const Member &member, std::string &text) const
+    {
+        const char *stored = mapping->data() + member.offset;
+        if (!member.deflated)
+        {
+            text.assign(stored, member.size);
+            return true;
+        }
+#ifdef WGSL_HAVE_ZLIB
+        text.resize(member.size);
+        z_stream stream = {};
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) return false;
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(stored));
+        stream.avail_in = static_cast<uInt>(member.storedSize);
+        stream.next_out = reinterpret_cast<Bytef *>(text.data());
+        stream.avail_out = static_cast<uInt>(text.size());
+        int status = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        return status == Z_STREAM_END && stream.total_out == member.size;
+#else
+        std::cerr << "Error: Deflated archive members need a build with zlib: " << archivePath << std::endl;
+        return false;
+#endif
+    }
+
+    std::filesystem::path archivePath;
+    FileIdentity archiveIdentity;
+    std::unique_ptr<MappedFile> mapping;
+    std::map<std::string, Member> members;
+    bool indexed = false;
+    std::mutex mutex;
+};
+
+#ifdef WGSL_HAVE_ZLIB
+
+/**
+ * @brief Serves the files of one git commit from a local object store, without a checkout.
+ *
+ * With --git-rev <rev>, paths under the work tree (the directory holding .git) are read from
+ * that commit instead of the disk. Objects come from loose files or from packfiles, which are
+ * mapped once and looked up through their version 2 .idx. Delta chains are resolved through an
+ * LRU cache of recently inflated pack objects, so files sharing a base inflate it once.
+ */
+class GitProvider : public SourceProvider
+{
+public:
+    // Opens the repository; false, after reporting why, if it or the revision cannot be read.
+    bool open(const std::filesystem::path &workTree, const std::filesystem::path &gitDirectory, const std::string &revision)
+    {
+        this->workTree = workTree;
+        gitDir = gitDirectory;
+        commonDir = gitDir;
+        std::string common;
+        if (readText(gitDir / "commondir", common))
+        {
+            commonDir = (gitDir / trim(common)).lexically_normal(); // a linked work tree shares its objects
+        }
+        openPacks();
+
+        // "<name>~<n>" walks n first parents, "<name>^<n>" takes the n-th parent (^0 is the commit itself)
+        size_t ancestry = revision.find_first_of("~^");
+        std::string commit;
+        std::string data;
+        if (!resolveRevision(revision.substr(0, ancestry), commit) || !readCommit(commit, data))
+        {
+            std::cerr << "Error: Unknown git revision: " << revision << std::endl;
+            return false;
+        }
+        for (size_t position = ancestry; position < revision.size();)
+        {
+            char step = revision[position++];
+            size_t digits = revision.find_first_not_of("0123456789", position);
+            if (digits == std::string::npos) digits = revision.size();
+            uint32_t count = digits > position ? static_cast<uint32_t>(std::stoul(revision.substr(position, digits - position))) : 1;
+            position = digits;
+            uint32_t parentNumber = step == '^' ? count : 1;
+            uint32_t steps = step == '^' ? std::min<uint32_t>(count, 1) : count;
+            for (uint32_t i = 0; i < steps; i++)
+            {
+                if (!parentOf(data, parentNumber, commit) || !readCommit(commit, data))
+                {
+                    std::cerr << "Error: No such ancestor: " << revision << std::endl;
+                    return false;
+                }
+            }
+        }
+        return fromHex(data.substr(5, 40), rootTree);
+    }
+
+    bool provides(const std::filesystem::path &filePath) const override
+    {
+        const std::string &path = filePath.native();
+        const std::string &root = workTree.native();
+        return path.size() > root.size() + 1 && path.compare(0, root.size(), root) == 0 && path[root.size()] == '/';
+    }
+
+    bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string blob;
+        std::string type;
+        if (!findBlob(filePath, blob) || !readObject(blob, type, text) || type != "blob") return false;
+        identity = blobIdentity(blob, text.size());
+        return true;
+    }
+
+    bool identify(const std::filesystem::path &filePath, FileIdentity &identity) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string blob;
+        std::string type;
+        std::string text;
+        if (!findBlob(filePath, blob)) return false;
+        auto size = blobSizes.find(blob);
+        if (size == blobSizes.end() && (!readObject(blob, type, text) || type != "blob")) return false;
+        identity = blobIdentity(blob, blobSizes[blob]);
+        return true;
+    }
+
+    // A commit never changes; what can is the ref the revision was resolved through.
+    std::vector<std::filesystem::path> backingFiles(const std::filesystem::path &) override { return refFiles; }
+
+    // Looks for .git from the directory upwards; sets the work tree and git directory if found.
+    static bool discover(std::filesystem::path directory, std::filesystem::path &workTree, std::filesystem::path &gitDirectory)
+    {
+        while (true)
+        {
+            std::filesystem::path dotGit = directory / ".git";
+            std::error_code error;
+            if (std::filesystem::is_directory(dotGit, error))
+            {
+                workTree = directory;
+                gitDirectory = dotGit;
+                return true;
+            }
+            std::string pointer;
+            if (readText(dotGit, pointer) && pointer.rfind("gitdir: ", 0) == 0)
+            {
+                workTree = directory;
+                gitDirectory = (directory / trim(pointer.substr(8))).lexically_normal();
+                return true;
+            }
+            if (directory == directory.parent_path()) return false;
+            directory = directory.parent_path();
+        }
+    }
+
+private:
+    struct Pack
+    {
+        MappedFile index;
+        MappedFile data;
+        uint32_t objects = 0;
+    };
+
+    struct CachedObject
+    {
+        std::string type;
+        std::string data;
+    };
+
+    static std::string trim(std::string text)
+    {
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) text.pop_back();
+        return text;
+    }
+
+    static bool readText(const std::filesystem::path &filePath, std::string &text)
+    {
+        FileIdentity identity;
+        return readWholeFile(filePath, text, identity);
+    }
+
+    static bool fromHex(std::string_view hex, std::string &raw)
+    {
+        if (hex.size() != 40) return false;
+        raw.assign(20, '\0');
+        for (size_t i = 0; i < 40; i++)
+        {
+            char c = static_cast<char>(std::tolower(static_cast<unsigned char>(hex[i])));
+            int nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (nibble < 0) return false;
+            raw[i / 2] = static_cast<char>(raw[i / 2] | (nibble << (i % 2 == 0 ? 4 : 0)));
+        }
+        return true;
+    }
+
+    static std::string toHex(std::string_view raw)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (unsigned char byte : raw)
+        {
+            hex += digits[byte >> 4];
+            hex += digits[byte & 15];
+        }
+        return hex;
+    }
+
+    static FileIdentity blobIdentity(const std::string &blob, uint64_t size)
+    {
+        FileIdentity identity;
+        std::memcpy(&identity.inode, blob.data(), sizeof(identity.inode)); // the blob id stands in for the inode
+        identity.size = size;
+        return identity;
+    }
+
+    void openPacks()
+    {
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(commonDir / "objects" / "pack", error))
+        {
+            if (entry.path().extension() != ".idx") continue;
+            auto pack = std::make_unique<Pack>();
+            std::filesystem::path packPath = entry.path();
+            packPath.replace_extension(".pack");
+            if (!pack->index.open(entry.path()) || !pack->data.open(packPath) || pack->index.size() < 8 + 256 * 4) continue;
+            const unsigned char *index = reinterpret_cast<const unsigned char *>(pack->index.data());
+            if (std::memcmp(index, "\377tOc", 4) != 0 || bigEndian(index + 4) != 2) continue; // only version 2 indexes
+            pack->objects = bigEndian(index + 8 + 255 * 4);
+            if (pack->index.size() < 8 + 256 * 4 + uint64_t(pack->objects) * 28) continue;
+            packs.push_back(std::move(pack));
+        }
+    }
+
+    static uint32_t bigEndian(const unsigned char *bytes)
+    {
+        return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | uint32_t(bytes[3]);
+    }
+
+    // Reads the commit an object names, peeling annotated tags.
+    bool readCommit(std::string &object, std::string &data)
+    {
+        std::string type;
+        while (readObject(object, type, data) && type == "tag")
+        {
+            if (data.rfind("object ", 0) != 0 || !fromHex(data.substr(7, 40), object)) return false;
+        }
+        return type == "commit" && data.rfind("tree ", 0) == 0;
+    }
+
+    // The n-th "parent" line of a commit's header, counting from 1.
+    static bool parentOf(const std::string &commitData, uint32_t number, std::string &parent)
+    {
+        size_t headerEnd = commitData.find("\n\n");
+        size_t position = 0;
+        for (uint32_t i = 0; i < number; i++)
+        {
+            position = commitData.find("\nparent ", position);
+            if (position == std::string::npos || position >= headerEnd) return false;
+            position += 8;
+        }
+        return fromHex(commitData.substr(position, 40), parent);
+    }
+
+    bool resolveRevision(const std::string &revision, std::string &object)
+    {
+        if (fromHex(revision, object)) return true;
+        std::string head;
+        if (revision == "HEAD" && readText(gitDir / "HEAD", head))
+        {
+            refFiles.push_back(gitDir / "HEAD");
+            head = trim(head);
+            return head.rfind("ref: ", 0) == 0 ? resolveRevision(head.substr(5), object) : fromHex(head, object);
+        }
+        for (std::string candidate : {revision, "refs/" + revision, "refs/tags/" + revision, "refs/heads/" + revision, "refs/remotes/" + revision})
+        {
+            std::string value;
+            if (readText(commonDir / candidate, value) && fromHex(trim(value), object))
+            {
+                refFiles.push_back(commonDir / candidate);
+                return true;
+            }
+            if (readText(commonDir / "packed-refs", value))
+            {
+                std::istringstream lines(value);
+                std::string line;
+                while (std::getline(lines, line))
+                {
+                    if (line.size() > 41 && line.compare(41, std::string::npos, candidate) == 0)
+                    {
+                        refFiles.push_back(commonDir / "packed-refs");
+                        return fromHex(line.substr(0, 40), object);
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    bool findBlob(const std::filesystem::path &filePath, std::string &blob)
+    {
+        std::string tree = rootTree;
+        std::filesystem::path relative = filePath.lexically_relative(workTree);
+        for (auto component = relative.begin(); component != relative.end(); ++component)
+        {
+            const std::map<std::string, std::string> &entries = treeEntries(tree);
+            auto entry = entries.find(component->string());
+            if (entry == entries.end()) return false;
+            tree = entry->second;
+        }
+        blob = tree;
+        return true;
+    }
+
+    const std::map<std::string, std::string> &treeEntries(const std::string &tree)
+    {
+        auto cached = trees.find(tree);
+        if (cached != trees.end()) return cached->second;
+        std::map<std::string, std::string> &entries = trees[tree];
+        std::string type;
+        std::string data;
+        if (!readObject(tree, type, data) || type != "tree") return entries;
+        // "<mode> <name>\0<20-byte id>" per entry
+        size_t position = 0;
+        while (position < data.size())
+        {
+            size_t space = data.find(' ', position);
+            size_t terminator = data.find('\0', position);
+            if (space == std::string::npos || terminator == std::string::npos || terminator + 21 > data.size()) break;
+            entries[data.substr(space + 1, terminator - space - 1)] = data.substr(terminator + 1, 20);
+            position = terminator + 21;
+        }
+        return entries;
+    }
+
+    bool readObject(const std::string &object, std::string &type, std::string &data)
+    {
+        for (size_t pack = 0; pack < packs.size(); pack++)
+        {
+            uint64_t offset;
+            if (findInPack(*packs[pack], object, offset))
+            {
+                std::shared_ptr<const CachedObject> found = readPackObject(pack, offset);
+                if (!found) return false;
+                type = found->type;
+                data = found->data;
+                if (type == "blob") blobSizes[object] = data.size();
+                return true;
+            }
+        }
+
+        // A loose object: zlib("<type> <size>\0<data>")
+        std::string hex = toHex(object);
+        std::string compressed;
+        std::string inflated;
+        if (!readText(commonDir / "objects" / hex.substr(0, 2) / hex.substr(2), compressed) ||
+            !inflateStream(reinterpret_cast<const unsigned char *>(compressed.data()), compressed.size(), 0, inflated))
+        {
+            return false;
+        }
+        size_t space = inflated.find(' ');
+        size_t terminator = inflated.find('\0');
+        if (space == std::string::npos || terminator == std::string::npos || space > terminator) return false;
+        type = inflated.substr(0, space);
+        data = inflated.substr(terminator + 1);
+        if (type == "blob") blobSizes[object] = data.size();
+        return true;
+    }
+
+    bool findInPack(const Pack &pack, const std::string &object, uint64_t &offset) const
+    {
+        const unsigned char *index = reinterpret_cast<const unsigned char *>(pack.index.data());
+        unsigned char first = static_cast<unsigned char>(object[0]);
+        uint32_t low = first == 0 ? 0 : bigEndian(index + 8 + (first - 1) * 4);
+        uint32_t high = bigEndian(index + 8 + first * 4);
+        const unsigned char *names = index + 8 + 256 * 4;
+        while (low < high)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            int order = std::memcmp(names + uint64_t(middle) * 20, object.data(), 20);
+            if (order == 0)
+            {
+                const unsigned char *offsets = names + uint64_t(pack.objects) * 24; // after names and CRCs
+                uint32_t small = bigEndian(offsets + uint64_t(middle) * 4);
+                if (!(small & 0x80000000))
+                {
+                    offset = small;
+                    return true;
+                }
+                const unsigned char *large = offsets + uint64_t(pack.objects) * 4 + uint64_t(small & 0x7fffffff) * 8;
+                if (large + 8 > index + pack.index.size()) return false;
+                offset = uint64_t(bigEndian(large)) << 32 | bigEndian(large + 4);
+                return true;
+            }
+            if (order < 0) low = middle + 1;
+            else high = middle;
+        }
+        return false;
+    }
+
+    std::shared_ptr<const CachedObject> readPackObject(size_t packIndex, uint64_t offset)
+    {
+        auto cached = deltaCache.find({packIndex, offset});
+        if (cached != deltaCache.end())
+        {
+            deltaLru.splice(deltaLru.begin(), deltaLru, cached->second.position);
+            return cached->second.object;
+        }
+
+        const Pack &pack = *packs[packIndex];
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(pack.data.data());
+        uint64_t size = pack.data.size();
+        if (offset >= size) return nullptr;
+
+        // Header: type in bits 4-6 of the first byte, size as a little-endian varint
+        uint64_t position = offset;
+        unsigned char byte = data[position++];
+        int type = (byte >> 4) & 7;
+        uint64_t objectSize = byte & 15;
+        for (int shift = 4; byte & 0x80; shift += 7)
+        {
+            if (position >= size) return nullptr;
+            byte = data[position++];
+            objectSize |= uint64_t(byte & 0x7f) << shift;
+        }
+
+        auto object = std::make_shared<CachedObject>();
+        static const char *const typeNames[] = {"", "commit", "tree", "blob", "tag"};
+        if (type >= 1 && type <= 4)
+        {
+            object->type = typeNames[type];
+            if (!inflateStream(data + position, size - position, objectSize, object->data)) return nullptr;
+        }
+        else if (type == 6 || type == 7)
+        {
+            std::shared_ptr<const CachedObject> base;
+            if (type == 6)
+            {
+                // Offset back to the base, in git's "add one per continuation byte" encoding
+                if (position >= size) return nullptr;
+                byte = data[position++];
+                uint64_t distance = byte & 0x7f;
+                while (byte & 0x80)
+                {
+                    if (position >= size) return nullptr;
+                    byte = data[position++];
+                    distance = ((distance + 1) << 7) | (byte & 0x7f);
+                }
+                if (distance > offset) return nullptr;
+                base = readPackObject(packIndex, offset - distance);
+            }
+            else
+            {
+                if (position + 20 > size) return nullptr;
+                std::string baseObject(reinterpret_cast<const char *>(data + position), 20);
+                position += 20;
+                auto resolved = std::make_shared<CachedObject>();
+                if (readObject(baseObject, resolved->type, resolved->data)) base = resolved;
+            }
+            std::string delta;
+            if (!base || !inflateStream(data + position, size - position, objectSize, delta) ||
+                !applyDelta(base->data, delta, object->data))
+            {
+                return nullptr;
+            }
+            object->type = base->type;
+        }
+        else
+        {
+            return nullptr;
+        }
+
+        remember({packIndex, offset}, object);
+        return object;
+    }
+
+    // Keeps recently inflated pack objects (delta bases above all) up to a byte budget.
+    void remember(std::pair<size_t, uint64_t> key, std::shared_ptr<const CachedObject> object)
+    {
+        const uint64_t budget = 64ull << 20;
+        deltaLru.push_front(key);
+        deltaCacheBytes += object->data.size();
+        deltaCache[key] = {std::move(object), deltaLru.begin()};
+        while (deltaCacheBytes > budget && deltaLru.size() > 1)
+        {
+            auto evicted = deltaCache.find(deltaLru.back());
+            deltaCacheBytes -= evicted->second.object->data.size();
+            deltaCache.erase(evicted);
+            deltaLru.pop_back();
+        }
+    }
+
+    static bool applyDelta(const std::string &base, const std::string &delta, std::string &result)
+    {
+        size_t position = 0;
+        auto varint = [&](uint64_t &value) {
+            value = 0;
+            for (int shift = 0; position < delta.size(); shift += 7)
+            {
+                unsigned char byte = static_cast<unsigned char>(delta[position++]);
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return true;
+            }
+            return false;
+        };
+        uint64_t baseSize;
+        uint64_t resultSize;
+        if (!varint(baseSize) || !varint(resultSize) || baseSize != base.size()) return false;
+        result.clear();
+        result.reserve(resultSize);
+        while (position < delta.size())
+        {
+            unsigned char instruction = static_cast<unsigned char>(delta[position++]);
+            if (instruction & 0x80)
+            {
+                // Copy from the base; which offset and size bytes follow is given by the low 7 bits
+                uint64_t copyOffset = 0;
+                uint64_t copySize = 0;
+                for (int bit = 0; bit < 7; bit++)
+                {
+                    if (!(instruction & (1 << bit))) continue;
+                    if (position >= delta.size()) return false;
+                    uint64_t byte = static_cast<unsigned char>(delta[position++]);
+                    if (bit < 4) copyOffset |= byte << (8 * bit);
+                    else copySize |= byte << (8 * (bit - 4));
+                }
+                if (copySize == 0) copySize = 0x10000;
+                if (copyOffset + copySize > base.size()) return false;
+                result.append(base, copyOffset, copySize);
+            }
+            else if (instruction != 0)
+            {
+                if (position + instruction > delta.size()) return false;
+                result.append(delta, position, instruction);
+                position += instruction;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return result.size() == resultSize;
+    }
+
+    // Inflates one zlib stream; expectedSize 0 means unknown.
+    static bool inflateStream(const unsigned char *input, uint64_t available, uint64_t expectedSize, std::string &output)
+    {
+        z_stream stream = {};
+        if (inflateInit(&stream) != Z_OK) return false;
+        stream.next_in = const_cast<Bytef *>(input);
+        stream.avail_in = static_cast<uInt>(std::min<uint64_t>(available, UINT32_MAX));
+        output.resize(expectedSize != 0 ? expectedSize : 4096);
+        int status = Z_OK;
+        while (status == Z_OK)
+        {
+            if (stream.total_out == output.size()) output.resize(output.size() * 2);
+            stream.next_out = reinterpret_cast<Bytef *>(output.data() + stream.total_out);
+            stream.avail_out = static_cast<uInt>(output.size() - stream.total_out);
+            status = inflate(&stream, Z_NO_FLUSH);
+        }
+        output.resize(stream.total_out);
+        inflateEnd(&stream);
+        return status == Z_STREAM_END && (expectedSize == 0 || output.size() == expectedSize);
+    }
+
+    struct DeltaCacheEntry
+    {
+        std::shared_ptr<const CachedObject> object;
+        std::list<std::pair<size_t, uint64_t>>::iterator position;
+    };
+
+    std::filesystem::path workTree;
+    std::filesystem::path gitDir;
+    std::filesystem::path commonDir;
+    std::string rootTree;
+    std::vector<std::filesystem::path> refFiles; // HEAD, loose refs or packed-refs the revision was read from
+    std::vector<std::unique_ptr<Pack>> packs;
+    std::map<std::string, std::map<std::string, std::string>> trees;
+    std::map<std::string, uint64_t> blobSizes;
+    std::map<std::pair<size_t, uint64_t>, DeltaCacheEntry> deltaCache;
+    std::list<std::pair<size_t, uint64_t>> deltaLru;
+    uint64_t deltaCacheBytes = 0;
+    std::mutex mutex;
+};
+
+#endif // WGSL_HAVE_ZLIB
+
+/**
+ * @brief Reads ".gz" and ".zst" files decompressed, so generated sources can be stored
+ * compressed: "#include \"gen/lights.wgsl.gz\"" includes the decompressed text.
+ *
+ * The compressed file is mapped and decoded in chunks straight into the source text, which
+ * the directive scanner then reads as usual. Identities are those of the compressed file on
+ * disk, so plans and the cache revalidate them like any other file. ".zst" needs a build with
+ * libzstd, ".gz" one with zlib.
+ */
+class CompressedFileProvider : public SourceProvider
+{
+public:
+    static bool isCompressedPath(const std::filesystem::path &filePath)
+    {
+        const std::string &path = filePath.native();
+        return (path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0) ||
+               (path.size() > 4 && path.compare(path.size() - 4, 4, ".zst") == 0);
+    }
+
+    bool provides(const std::filesystem::path &filePath) const override { return isCompressedPath(filePath); }
+
+    bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity) override
+    {
+        MappedFile compressed;
+        if (!readFileIdentity(filePath, identity) || !compressed.open(filePath)) return false;
+        text.clear();
+        bool decoded = filePath.extension() == ".gz" ? decodeGzip(compressed, text) : decodeZstd(compressed, text);
+        if (!decoded) std::cerr << "Error: Could not decompress: " << filePath << std::endl;
+        return decoded;
+    }
+
+    bool identify(const std::filesystem::path &filePath, FileIdentity &identity) override
+    {
+        return readFileIdentity(filePath, identity);
+    }
+
+private:
+    static constexpr size_t chunkSize = 256 * 1024;
+
+    static bool decodeGzip(const MappedFile &compressed, std::string &text)
+    {
+#ifdef WGSL_HAVE_ZLIB
+        const unsigned char *input = reinterpret_cast<const unsigned char *>(compressed.data());
+        size_t remaining = compressed.size();
+        if (remaining >= 18)
+        {
+            // The trailer holds the last member's size mod 2^32; enough to size the text for one member
+            const unsigned char *trailer = input + remaining - 4;
+            text.reserve(uint32_t(trailer[0]) | uint32_t(trailer[1]) << 8 | uint32_t(trailer[2]) << 16 | uint32_t(trailer[3]) << 24);
+        }
+        z_stream stream = {};
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) return false;
+        int status = Z_OK;
+        while (true)
+        {
+            if (status == Z_STREAM_END)
+            {
+                inflateReset(&stream); // concatenated members, as gzip writes for appended files
+            }
+            if (stream.avail_in == 0)
+            {
+                size_t take = std::min(remaining, chunkSize);
+                stream.next_in = const_cast<Bytef *>(input + (compressed.size() - remaining));
+                stream.avail_in = static_cast<uInt>(take);
+                remaining -= take;
+            }
+            size_t used = text.size();
+            text.resize(used + chunkSize);
+            stream.next_out = reinterpret_cast<Bytef *>(text.data() + used);
+            stream.avail_out = static_cast<uInt>(chunkSize);
+            status = inflate(&stream, Z_NO_FLUSH);
+            text.resize(used + (chunkSize - stream.avail_out));
+            if (status != Z_OK && status != Z_STREAM_END) break;
+            if (status == Z_STREAM_END && remaining == 0 && stream.avail_in == 0) break;
+        }
+        inflateEnd(&stream);
+        return status == Z_STREAM_END;
+#else
+        (void)compressed;
+        (void)text;
+        std::cerr << "Error: .gz sources need a build with zlib" << std::endl;
+        return false;
+#endif
+    }
+
+    static bool decodeZstd(const MappedFile &compressed, std::string &text)
+    {
+#ifdef WGSL_HAVE_ZSTD
+        unsigned long long contentSize = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+        if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN && contentSize != ZSTD_CONTENTSIZE_ERROR) text.reserve(contentSize);
+        ZSTD_DStream *stream = ZSTD_createDStream();
+        if (stream == nullptr) return false;
+        ZSTD_inBuffer input = {compressed.data(), compressed.size(), 0};
+        size_t status = 1;
+        while (input.pos < input.size)
+        {
+            size_t used = text.size();
+            text.resize(used + chunkSize);
+            ZSTD_outBuffer output = {text.data() + used, chunkSize, 0};
+            status = ZSTD_decompressStream(stream, &output, &input);
+            text.resize(used + output.pos);
+            if (ZSTD_isError(status)) break;
+        }
+        while (status != 0 && !ZSTD_isError(status))
+        {
+            // Input consumed, but the decoder may still hold output
+            size_t used = text.size();
+            text.resize(used + chunkSize);
+            ZSTD_outBuffer output = {text.data() + used, chunkSize, 0};
+            status = ZSTD_decompressStream(stream, &output, &input);
+            text.resize(used + output.pos);
+            if (output.pos == 0) break;
+        }
+        ZSTD_freeDStream(stream);
+        return status == 0;
+#else
+        (void)compressed;
+        (void)text;
+        std::cerr << "Error: .zst sources need a build with libzstd" << std::endl;
+        return false;
+#endif
+    }
+};
+
+/**
+ * @brief Runs a --generator command: "/bin/sh -c <command> gen <arguments>", so the command
+ * sees the include's argument string as $1 and prints the generated source.
+ *
+ * @return True if the command exited with status 0.
+ */
+bool runGeneratorCommand(const std::string &command, std::string_view arguments, std::string &output)
+{
+#ifdef _WIN32
+    (void)command;
+    (void)arguments;
+    (void)output;
+    std::cerr << "Error: --generator is not supported on this platform" << std::endl;
+    return false;
+#else
+    int pipeDescriptors[2];
+    if (pipe(pipeDescriptors) != 0) return false;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeDescriptors[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipeDescriptors[0]);
+    posix_spawn_file_actions_addclose(&actions, pipeDescriptors[1]);
+
+    std::string argumentString(arguments);
+    std::vector<char *> childArguments = {const_cast<char *>("/bin/sh"), const_cast<char *>("-c"), const_cast<char *>(command.c_str()),
+                                          const_cast<char *>("gen"), argumentString.data(), nullptr};
+    pid_t child;
+    int spawned = posix_spawn(&child, "/bin/sh", &actions, nullptr, childArguments.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeDescriptors[1]);
+    if (spawned != 0)
+    {
+        close(pipeDescriptors[0]);
+        return false;
+    }
+
+    char buffer[65536];
+    while (true)
+    {
+        ssize_t got = read(pipeDescriptors[0], buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        output.append(buffer, static_cast<size_t>(got));
+    }
+    close(pipeDescriptors[0]);
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// A source file as read from disk, together with the #include names found near its top.
+struct SourceFile
+{
+    FileIdentity identity;
+    std::string text;
+    std::vector<std::string> includes;
+};
+
+/**
+ * @brief Reads and scans source files once, then serves them from memory while they are unchanged.
+ *
+ * A cached file is revalidated with one stat per generation; callers start a new generation
+ * whenever files may have changed on disk (for example at the start of each daemon request).
+ * load() may be called from several threads; the lock is not held while reading from disk.
+ */
+class SourceCache
+{
+public:
+    std::shared_ptr<const SourceFile> load(const std::filesystem::path &filePath)
+    {
+        std::shared_ptr<const SourceFile> previous;
+        uint64_t currentGeneration;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto cached = files.find(filePath);
+            if (cached != files.end() && cached->second.generation == generation)
+            {
+                hits++;
+                return cached->second.source;
+            }
+            if (cached != files.end())
+            {
+                previous = cached->second.source;
+            }
+            currentGeneration = generation;
+        }
+
+        SourceProvider *provider = providerFor(filePath);
+        if (previous)
+        {
+            FileIdentity identity;
+            bool current = provider != nullptr ? !provider->identify(filePath, identity) || previous->identity == identity
+                                               : readFileIdentity(filePath, identity) && previous->identity == identity;
+            if (current)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto cached = files.find(filePath);
+                if (cached != files.end() && cached->second.source == previous)
+                {
+                    cached->second.generation = currentGeneration;
+                }
+                hits++;
+                return previous;
+            }
+        }
+
+        MemoryTagScope memoryTag(MemoryTag::Sources);
+        auto source = std::make_shared<SourceFile>();
+        bool read = provider != nullptr ? provider->read(filePath, source->text, source->identity)
+                                        : readWholeFile(filePath, source->text, source->identity);
+        if (!read)
+        {
+            return nullptr;
+        }
+        scanIncludes(filePath, *source);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        misses++;
+        auto cached = files.find(filePath);
+        if (cached != files.end())
+        {
+            cachedBytes -= cached->second.source->text.size();
+        }
+        cachedBytes += source->text.size();
+        files[filePath] = {source, currentGeneration};
+        return source;
+    }
+
+    // Reads a file through its provider, or from disk, without caching or scanning it.
+    bool read(const std::filesystem::path &filePath, std::string &text, FileIdentity &identity)
+    {
+        SourceProvider *provider = providerFor(filePath);
+        return provider != nullptr ? provider->read(filePath, text, identity) : readWholeFile(filePath, text, identity);
+    }
+
+    // Providers are added before the first load() and live as long as the cache.
+    void addProvider(std::unique_ptr<SourceProvider> provider) { providers.push_back(std::move(provider)); }
+
+    SourceProvider *providerFor(const std::filesystem::path &filePath) const
+    {
+        for (const auto &provider : providers)
+        {
+            if (provider->provides(filePath)) return provider.get();
+        }
+        return nullptr;
+    }
+
+    void nextGeneration()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+    }
+
+    // Adds a source whose identity the caller has already validated against the disk.
+    void insert(const std::filesystem::path &filePath, std::shared_ptr<const SourceFile> source)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cachedBytes += source->text.size();
+        files[filePath] = {std::move(source), generation};
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor visitor) const
+    {
+        for (const auto &[filePath, entry] : files)
+        {
+            visitor(filePath, *entry.source);
+        }
+    }
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> cachedBytes{0};
+
+private:
+    // Collects the "#include \"name\"" lines; includes should be near the top, so scanning
+    // stops after five consecutive lines without one.
+    static void scanIncludes(const std::filesystem::path &filePath, SourceFile &source)
+    {
+        const std::string include_directive_prefix = "#include \"";
+        uint32_t nothingFoundCount = 0;
+        size_t lineStart = 0;
+        while (lineStart < source.text.size() && nothingFoundCount < 5)
+        {
+            size_t lineEnd = source.text.find('\n', lineStart);
+            if (lineEnd == std::string::npos) lineEnd = source.text.size();
+            std::string_view line(source.text.data() + lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+
+            if (line.rfind(include_directive_prefix, 0) == 0)
+            {
+                size_t start_quote_pos = include_directive_prefix.length();
+                size_t end_quote_pos = line.find('"', start_quote_pos);
+                if (end_quote_pos != std::string::npos)
+                {
+                    source.includes.emplace_back(line.substr(start_quote_pos, end_quote_pos - start_quote_pos));
+                    nothingFoundCount = 0;
+                }
+                else
+                {
+                    std::cerr << "Warning: Malformed #include directive in " << filePath << ": " << line << std::endl;
+                }
+            }
+            else
+            {
+                nothingFoundCount++;
+            }
+        }
+    }
+
+    struct Entry
+    {
+        std::shared_ptr<const SourceFile> source;
+        uint64_t generation;
+    };
+    std::map<std::filesystem::path, Entry> files;
+    uint64_t generation = 0;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<SourceProvider>> providers;
+};
+
+/**
+ * @brief Preprocesses a text file, handling #include directives with relative path resolution and circular include detection.
+ *
+ * This function reads the content of a file. If it encounters a line
+ * starting with "#include \"<filename>\"", it resolves <filename> relative to
+ * currentBaseDir, recursively processes the included file, and inserts its content.
+ * It detects and reports circular include dependencies to prevent infinite recursion.
+ *
+ * @param filePath The absolute path to the file currently being processed.
+ * @param currentBaseDir The directory from which relative #include paths within filePath
+ * should be resolved.
+ * @param activeIncludes A set tracking the absolute paths of files currently in the include stack.
+ * @param sources The cache the file and its scanned #include names are read through.
+ * @param prefix Optional precompiled prefix; its files are treated as already resolved.
+ * @return True if preprocessing was successful for the given file, false otherwise.
+ */
+bool findIncludes(const std::filesystem::path &filePath,
+                    const std::filesystem::path &currentBaseDir,
+                    std::map<std::filesystem::path, uint32_t> &activeIncludes,
+                    uint32_t depth,
+                    SourceCache &sources,
+                    PrefixSnapshot *prefix = nullptr)
+{ 
+    if (prefix != nullptr && prefix->files.count(filePath))
+    {
+        prefix->reached = true;
+        return true; // emitted from the snapshot, and prefix files never include anything outside it
+    }
+    try {
+        if(activeIncludes.at(filePath) < depth) {
+            activeIncludes.insert_or_assign(filePath, depth);
+            return true; //skip finding includes since we have already done it on this file
+        }
+    }
+    catch (const std::out_of_range &)
+    {
+        MemoryTagScope memoryTag(MemoryTag::Graph);
+        activeIncludes[filePath] = depth;
+    }
+    std::shared_ptr<const SourceFile> source = sources.load(filePath);
+    if (!source)
+    {
+        std::cerr << "Error: Could not open file: " << filePath << std::endl;
+        activeIncludes.erase(filePath);
+        return false;
+    }
+
+    for (const auto &includedRelativeFileName : source->includes)
+    {
+        std::filesystem::path absoluteIncludedPath;
+        std::filesystem::path nextBaseDir;
+        {
+            MemoryTagScope memoryTag(MemoryTag::Paths);
+            if (GeneratorProvider::isGeneratedPath(includedRelativeFileName))
+            {
+                absoluteIncludedPath = includedRelativeFileName; // a name, not a place on disk
+                nextBaseDir = currentBaseDir;
+            }
+            else
+            {
+                absoluteIncludedPath = currentBaseDir / includedRelativeFileName;
+                if (sources.providerFor(absoluteIncludedPath.lexically_normal()) != nullptr)
+                {
+                    absoluteIncludedPath = absoluteIncludedPath.lexically_normal(); // inside an archive
+                }
+                else
+                {
+                    removeDot(absoluteIncludedPath);
+                }
+                nextBaseDir = absoluteIncludedPath.parent_path();
+            }
+        }
+        if (!findIncludes(absoluteIncludedPath, nextBaseDir, activeIncludes, depth + 1, sources, prefix))
+        {
+            activeIncludes.erase(filePath); // Manual cleanup on error
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Cache directory
+//
+// --cache-dir holds #embed tables and, for --cache-server, remote objects. With --cache-size
+// it is kept under a byte cap, least recently used entries going first. Every process appends
+// fixed-size records (name, size, access time) to <dir>/index when it stores or hits an entry;
+// O_APPEND keeps concurrent appends whole, so readers and writers never lock anything. A
+// process that stored something starts one background evictor, which takes <dir>/evict.lock
+// without waiting (a busy lock means another process is already at it), and only if the index
+// says the cap is exceeded scans the directory, deletes the oldest entries down to 90% of the
+// cap and rewrites the index with one record per surviving entry.
+// ---------------------------------------------------------------------------
+
+struct CacheIndexRecord
+{
+    uint64_t size;
+    int64_t accessTime; // seconds since the epoch
+    char name[48];      // relative to the cache directory, zero-padded
+};
+static_assert(sizeof(CacheIndexRecord) == 64);
+
+class CacheDirectory
+{
+public:
+    CacheDirectory() = default;
+    CacheDirectory(const CacheDirectory &) = delete;
+    CacheDirectory &operator=(const CacheDirectory &) = delete;
+
+    ~CacheDirectory()
+    {
+        stopRequested = true; // what is left over is the next run's work
+        if (evictor.joinable()) evictor.join();
+    }
+
+    void configure(const std::filesystem::path &cacheDir, uint64_t capacity)
+    {
+        directory = cacheDir;
+        sizeCap = capacity;
+    }
+
+    const std::filesystem::path &path() const { return directory; }
+
+    // Notes a hit on an entry, for the LRU order.
+    void touch(const std::string &name, uint64_t size)
+    {
+        if (sizeCap != 0) appendRecord(name, size);
+    }
+
+    // Notes a new entry, and evicts in the background if the cache may now be over its cap.
+    void stored(const std::string &name, uint64_t size)
+    {
+        if (sizeCap == 0) return;
+        appendRecord(name, size);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (evictorRunning || (evictor.joinable() && now - lastEviction < std::chrono::seconds(30)))
+        {
+            return; // a long-running server checks at most every 30 seconds
+        }
+        if (evictor.joinable()) evictor.join();
+        lastEviction = now;
+        evictorRunning = true;
+        evictor = std::thread([this] {
+            evict();
+            evictorRunning = false;
+        });
+    }
+
+private:
+    static int64_t secondsNow()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void appendRecord(const std::string &name, uint64_t size)
+    {
+        CacheIndexRecord record{};
+        if (name.size() >= sizeof(record.name)) return; // untracked; the evictor still finds it by its mtime
+        record.size = size;
+        record.accessTime = secondsNow();
+        std::memcpy(record.name, name.data(), name.size());
+#ifndef _WIN32
+        int descriptor = ::open((directory / "index").c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (descriptor < 0) return;
+        ssize_t written = write(descriptor, &record, sizeof(record));
+        (void)written; // a lost record only makes its entry look older
+        close(descriptor);
+#else
+        std::ofstream index(directory / "index", std::ios::binary | std::ios::app);
+        index.write(reinterpret_cast<const char *>(&record), sizeof(record));
+#endif
+    }
+
+    // Latest record per name, from the index.
+    std::map<std::string, CacheIndexRecord> readIndex(size_t &count) const
+    {
+        std::map<std::string, CacheIndexRecord> entries;
+        MappedFile index;
+        count = 0;
+        if (!index.open(directory / "index")) return entries;
+        count = index.size() / sizeof(CacheIndexRecord);
+        for (size_t i = 0; i < count; i++)
+        {
+            CacheIndexRecord record;
+            std::memcpy(&record, index.data() + i * sizeof(record), sizeof(record));
+            record.name[sizeof(record.name) - 1] = '\0';
+            entries[record.name] = record;
+        }
+        return entries;
+    }
+
+    void evict()
+    {
+#ifdef _WIN32
+        return; // no flock(); caps are not enforced on this platform
+#else
+        // The lock file doubles as a marker: without it, entries stored while the cache was
+        // unbounded were never indexed, so the first eviction always scans.
+        std::error_code error;
+        bool firstEviction = !std::filesystem::exists(directory / "evict.lock", error);
+        int lockDescriptor = ::open((directory / "evict.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lockDescriptor < 0) return;
+        if (flock(lockDescriptor, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(lockDescriptor);
+            return;
+        }
+
+        size_t recordCount = 0;
+        std::map<std::string, CacheIndexRecord> indexed = readIndex(recordCount);
+        uint64_t indexedBytes = 0;
+        for (const auto &entry : indexed) indexedBytes += entry.second.size;
+        if (firstEviction || indexedBytes > sizeCap)
+        {
+            // The index can miss entries whose records were lost, so the directory is the truth
+            // for what exists; the index only adds access times newer than the files' mtimes.
+            struct Entry
+            {
+                int64_t accessTime;
+                uint64_t size;
+                std::filesystem::path path;
+                std::string name;
+            };
+            std::vector<Entry> entries;
+            uint64_t total = 0;
+            for (auto it = std::filesystem::recursive_directory_iterator(directory, error);
+                 !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+            {
+                if (!it->is_regular_file(error)) continue;
+                std::string name = it->path().lexically_relative(directory).generic_string();
+                if (name == "index" || name == "evict.lock" || name.find(".tmp") != std::string::npos) continue;
+                struct stat status;
+                if (stat(it->path().c_str(), &status) != 0) continue;
+                int64_t accessTime = status.st_mtime;
+                auto record = indexed.find(name);
+                if (record != indexed.end()) accessTime = std::max(accessTime, record->second.accessTime);
+                entries.push_back({accessTime, static_cast<uint64_t>(status.st_size), it->path(), name});
+                total += static_cast<uint64_t>(status.st_size);
+            }
+            std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.accessTime < b.accessTime; });
+
+            size_t kept = 0;
+            uint64_t target = sizeCap / 10 * 9;
+            // An exiting process still removes a first batch, so short runs make progress too
+            while (kept < entries.size() && total > target && (kept < 64 || !stopRequested))
+            {
+                std::filesystem::remove(entries[kept].path, error);
+                total -= entries[kept].size;
+                kept++;
+            }
+
+            std::string compacted;
+            for (size_t i = kept; i < entries.size(); i++)
+            {
+                CacheIndexRecord record{};
+                if (entries[i].name.size() >= sizeof(record.name)) continue;
+                record.size = entries[i].size;
+                record.accessTime = entries[i].accessTime;
+                std::memcpy(record.name, entries[i].name.data(), entries[i].name.size());
+                compacted.append(reinterpret_cast<const char *>(&record), sizeof(record));
+            }
+            writeFileAtomically(directory / "index", compacted);
+        }
+        else if (recordCount > indexed.size() * 4 + 1024)
+        {
+            // Under the cap, but hits keep appending: fold the index to its latest records
+            std::string compacted;
+            for (const auto &entry : indexed)
+            {
+                compacted.append(reinterpret_cast<const char *>(&entry.second), sizeof(entry.second));
+            }
+            writeFileAtomically(directory / "index", compacted);
+        }
+        flock(lockDescriptor, LOCK_UN);
+        close(lockDescriptor);
+#endif
+    }
+
+    std::filesystem::path directory;
+    uint64_t sizeCap = 0; // 0: unbounded, and no index is kept
+    std::thread evictor;
+    std::atomic<bool> evictorRunning{false};
+    std::atomic<bool> stopRequested{false};
+    std::chrono::steady_clock::time_point lastEviction;
+    std::mutex mutex;
+};
+
+// ---------------------------------------------------------------------------
+// Embedded data tables
+//
+//     #embed "noise_permutation.bin" u32 NOISE_PERMUTATION
+//     #embed "brdf_lut.csv" f32 BRDF_LUT
+//
+// becomes "const NOISE_PERMUTATION = array<u32, N>(...);". The path is relative to the file
+// containing the directive. Files ending in .csv or .txt hold numbers separated by commas or
+// whitespace; anything else is raw little-endian 32-bit elements. Element types are f32, i32
+// and u32. Generated text is kept in --cache-dir by content hash, so an unchanged table costs
+// one read of its data file, not a reformat.
+// ---------------------------------------------------------------------------
+
+enum class EmbedType { F32, I32, U32 };
+
+// Appends WGSL literals for the elements' bit patterns, 16 per line.
+void formatEmbedValues(const uint32_t *values, size_t count, EmbedType type, std::string &out)
+{
+    char line[16 * 24 + 8];
+    for (size_t chunkStart = 0; chunkStart < count; chunkStart += 16)
+    {
+        char *cursor = line;
+        *cursor++ = ' ';
+        *cursor++ = ' ';
+        *cursor++ = ' ';
+        *cursor++ = ' ';
+        size_t chunkEnd = std::min(count, chunkStart + 16);
+        for (size_t i = chunkStart; i < chunkEnd; i++)
+        {
+            char *end = line + sizeof(line);
+            if (type == EmbedType::F32)
+            {
+                cursor = std::to_chars(cursor, end, std::bit_cast<float>(values[i])).ptr;
+                *cursor++ = 'f';
+            }
+            else if (type == EmbedType::I32)
+            {
+                int32_t value = static_cast<int32_t>(values[i]);
+                if (value == INT32_MIN)
+                {
+                    std::memcpy(cursor, "(-2147483647i - 1i)", 19); // the literal 2147483648i is out of range
+                    cursor += 19;
+                }
+                else
+                {
+                    cursor = std::to_chars(cursor, end, value).ptr;
+                    *cursor++ = 'i';
+                }
+            }
+            else
+            {
+                cursor = std::to_chars(cursor, end, values[i]).ptr;
+                *cursor++ = 'u';
+            }
+            *cursor++ = ',';
+            *cursor++ = i + 1 == chunkEnd ? '\n' : ' ';
+        }
+        out.append(line, static_cast<size_t>(cursor - line));
+    }
+}
+
+/**
+ * @brief Turns data files into WGSL const arrays, reusing earlier results from a cache directory.
+ */
+class EmbedCache
+{
+public:
+    explicit EmbedCache(std::filesystem::path cacheDir = {}, CacheDirectory *index = nullptr)
+        : cacheDir(std::move(cacheDir)), index(index)
+    {
+    }
+
+    /**
+     * @brief Resolves the data file an #embed names, the way includes are resolved: relative
+     * to the file holding the directive, inside archives and git revisions too. "gen:" names
+     * are generated like includes; generated text cannot embed by relative path.
+     *
+     * @return False if the name cannot be resolved, which is only the case in generated text.
+     */
+    static bool resolveDataPath(const std::filesystem::path &includer, const std::string &fileName, SourceCache &sources,
+                                std::filesystem::path &dataPath)
+    {
+        if (isGeneratedPath(fileName))
+        {
+            dataPath = fileName;
+            return true;
+        }
+        if (isGeneratedPath(includer.native())) return false;
+        dataPath = includer.parent_path() / fileName;
+        if (sources.providerFor(dataPath.lexically_normal()) != nullptr) dataPath = dataPath.lexically_normal();
+        return true;
+    }
+
+    /**
+     * @brief Generates the declaration for one #embed directive.
+     *
+     * @param argument The directive's text after "#embed".
+     * @param includer The file containing the directive.
+     * @param sources Where the data is read through, so providers serve it like any include.
+     * @param dataPath Receives the resolved data file, for the emission plan.
+     * @param identity Receives the data file's identity.
+     * @param contentHash Receives hashBytes() of the data file.
+     * @param declaration Receives the generated WGSL.
+     * @return False, after reporting why, if the directive or its data is invalid.
+     */
+    bool generate(std::string_view argument, const std::filesystem::path &includer, SourceCache &sources,
+                  std::filesystem::path &dataPath, FileIdentity &identity, uint64_t &contentHash, std::string &declaration)
+    {
+        std::string fileName;
+        std::string typeName;
+        std::string name;
+        std::istringstream words{std::string(argument)};
+        words >> std::quoted(fileName) >> typeName >> name;
+        EmbedType type = typeName == "f32" ? EmbedType::F32 : typeName == "i32" ? EmbedType::I32 : EmbedType::U32;
+        if (fileName.empty() || name.empty() || (typeName != "f32" && typeName != "i32" && typeName != "u32"))
+        {
+            std::cerr << "Error: Expected #embed \"<file>\" <f32|i32|u32> <name>, got: #embed" << argument << std::endl;
+            return false;
+        }
+
+        if (!resolveDataPath(includer, fileName, sources, dataPath))
+        {
+            std::cerr << "Error: Generated source " << includer << " cannot #embed by relative path: " << fileName << std::endl;
+            return false;
+        }
+        std::string data;
+        if (!sources.read(dataPath, data, identity))
+        {
+            std::cerr << "Error: Could not open embedded file: " << dataPath << std::endl;
+            return false;
+        }
+        contentHash = hashBytes(data);
+
+        std::filesystem::path cachePath;
+        if (!cacheDir.empty())
+        {
+            char keyName[64];
+            std::string key = "embed v1\n" + typeName + "\n" + name + "\n" + dataExtension(dataPath) + "\n";
+            std::snprintf(keyName, sizeof(keyName), "embed-%016llx-%016llx.wgsl",
+                          static_cast<unsigned long long>(contentHash), static_cast<unsigned long long>(hashBytes(key)));
+            cachePath = cacheDir / keyName;
+            FileIdentity cachedIdentity;
+            if (readWholeFile(cachePath, declaration, cachedIdentity))
+            {
+                if (index != nullptr) index->touch(keyName, declaration.size());
+                return true;
+            }
+        }
+
+        std::vector<uint32_t> values;
+        std::string extension = dataExtension(dataPath);
+        if (extension == ".csv" || extension == ".txt" ? !parseText(data, type, values) : !parseBinary(data, values))
+        {
+            std::cerr << "Error: Invalid data in embedded file: " << dataPath << std::endl;
+            return false;
+        }
+        if (type == EmbedType::F32)
+        {
+            for (uint32_t bits : values)
+            {
+                if (!std::isfinite(std::bit_cast<float>(bits)))
+                {
+                    std::cerr << "Error: WGSL has no literal for inf or nan in embedded file: " << dataPath << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        declaration = "const " + name + " = array<" + typeName + ", " + std::to_string(values.size()) + ">(\n";
+        formatValues(values, type, declaration);
+        declaration += ");\n";
+
+        if (!cachePath.empty())
+        {
+            std::error_code error;
+            std::filesystem::create_directories(cacheDir, error);
+            // a failed cache write only costs a reformat next time
+            if (writeFileAtomically(cachePath, declaration) && index != nullptr) index->stored(cachePath.filename().string(), declaration.size());
+        }
+        return true;
+    }
+
+private:
+    // Decides the data format: ".csv" for "table.csv" and for "gen:table.csv?rows=4".
+    static std::string dataExtension(const std::filesystem::path &dataPath)
+    {
+        std::string name = dataPath.string();
+        if (isGeneratedPath(name)) name = name.substr(0, name.find('?'));
+        return std::filesystem::path(name).extension().string();
+    }
+
+    static bool parseBinary(const std::string &data, std::vector<uint32_t> &values)
+    {
+        if (data.size() % 4 != 0) return false;
+        values.resize(data.size() / 4);
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data.data()) + i * 4;
+            values[i] = uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+        }
+        return true;
+    }
+
+    static bool parseText(const std::string &data, EmbedType type, std::vector<uint32_t> &values)
+    {
+        const char *cursor = data.data();
+        const char *end = data.data() + data.size();
+        while (true)
+        {
+            while (cursor < end && (*cursor == ',' || std::isspace(static_cast<unsigned char>(*cursor)))) cursor++;
+            if (cursor == end) return true;
+            std::from_chars_result parsed;
+            if (type == EmbedType::F32)
+            {
+                float value = 0;
+                parsed = std::from_chars(cursor, end, value);
+                values.push_back(std::bit_cast<uint32_t>(value));
+            }
+            else if (type == EmbedType::I32)
+            {
+                int32_t value = 0;
+                parsed = std::from_chars(cursor, end, value);
+                values.push_back(static_cast<uint32_t>(value));
+            }
+            else
+            {
+                uint32_t value = 0;
+                parsed = std::from_chars(cursor, end, value);
+                values.push_back(value);
+            }
+            if (parsed.ec != std::errc()) return false;
+            cursor = parsed.ptr;
+        }
+    }
+
+    // Large tables are formatted in slices on several threads and joined in order.
+    static void formatValues(const std::vector<uint32_t> &values, EmbedType type, std::string &out)
+    {
+        const size_t sliceSize = 1 << 16; // a multiple of the 16 values per line
+        size_t slices = (values.size() + sliceSize - 1) / sliceSize;
+        if (slices <= 1)
+        {
+            formatEmbedValues(values.data(), values.size(), type, out);
+            return;
+        }
+        std::vector<std::string> formatted(slices);
+        std::atomic<size_t> nextSlice{0};
+        auto worker = [&] {
+            for (size_t slice = nextSlice++; slice < slices; slice = nextSlice++)
+            {
+                size_t first = slice * sliceSize;
+                formatEmbedValues(values.data() + first, std::min(sliceSize, values.size() - first), type, formatted[slice]);
+            }
+        };
+        std::vector<std::thread> workers;
+        size_t threads = std::min<size_t>(slices, std::max(1u, std::thread::hardware_concurrency()));
+        for (size_t i = 1; i < threads; i++) workers.emplace_back(worker);
+        worker();
+        for (auto &thread : workers) thread.join();
+        for (const auto &slice : formatted) out += slice;
+    }
+
+    std::filesystem::path cacheDir;
+    CacheDirectory *index;
+};
+
+// ---------------------------------------------------------------------------
+// Emission plans
+//
+// How a bundle was put together: the input files with the identities they had, and the
+// sequence of byte ranges (or literal bytes) that make up the output. If no input changed,
+// replaying the plan reproduces the bundle without scanning or sorting anything.
+// ---------------------------------------------------------------------------
+
+struct EmissionSegment
+{
+    static constexpr uint32_t literal = UINT32_MAX; // fileIndex of a segment stored in EmissionPlan::literals
+
+    uint32_t fileIndex;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct EmissionPlan
+{
+    std::vector<std::filesystem::path> files;
+    std::vector<FileIdentity> identities;
+    std::vector<uint64_t> contentHashes;  // hashBytes() of each file, 0 if unknown
+    std::vector<EmissionSegment> segments;
+    std::string literals;
+    std::string key;                      // the emissionKey() the plan was made with
+    FileIdentity outputIdentity;          // the output file as written, for up-to-date checks
+    uint64_t outputHash = 0;
+    uint64_t semanticHash = 0;            // semanticFingerprint() of the bundle, 0 unless --semantic-key
+    bool evaluated = false;               // conditionals are already applied (a fetched bundle)
+
+    uint32_t addFile(const std::filesystem::path &filePath, const FileIdentity &identity, uint64_t contentHash = 0)
+    {
+        files.push_back(filePath);
+        identities.push_back(identity);
+        contentHashes.push_back(contentHash);
+        return static_cast<uint32_t>(files.size() - 1);
+    }
+
+    void addRange(uint32_t fileIndex, uint64_t offset, uint64_t length)
+    {
+        if (!segments.empty() && segments.back().fileIndex == fileIndex &&
+            segments.back().offset + segments.back().length == offset)
+        {
+            segments.back().length += length; // consecutive kept lines become one copy
+            return;
+        }
+        segments.push_back({fileIndex, 0, offset, length});
+    }
+
+    void addLiteral(std::string_view bytes)
+    {
+        if (!segments.empty() && segments.back().fileIndex == EmissionSegment::literal)
+        {
+            segments.back().length += bytes.size();
+        }
+        else
+        {
+            segments.push_back({EmissionSegment::literal, 0, literals.size(), bytes.size()});
+        }
+        literals += bytes;
+    }
+};
+
+/**
+ * @brief Concatenates the sorted include list into a single bundle.
+ *
+ * Every line of every file is copied except lines containing an #include directive,
+ * which have already been resolved by findIncludes(), and #embed lines, which are replaced
+ * by the table they describe.
+ *
+ * @param includes The files to concatenate, in emission order.
+ * @param sources The cache holding the files' contents.
+ * @param bundle Receives the preprocessed bundle.
+ * @param plan Optional; receives the files and byte ranges the bundle was copied from.
+ * @param embedCache Optional; where #embed tables are cached.
+ * @return False if a file could not be read or an #embed failed; the rest is still assembled.
+ */
+bool assembleBundle(const std::vector<std::filesystem::path> &includes, SourceCache &sources, std::string &bundle,
+                    EmissionPlan *plan = nullptr, EmbedCache *embedCache = nullptr)
+{
+    EmbedCache uncachedEmbeds;
+    EmbedCache &embeds = embedCache != nullptr ? *embedCache : uncachedEmbeds;
+    MemoryTagScope memoryTag(MemoryTag::Output);
+    bool ok = true;
+    for (const auto& filePath : includes)
+    {
+        std::shared_ptr<const SourceFile> source = sources.load(filePath);
+        if (!source)
+        {
+            std::cerr << "Error: Could not open input file: " << filePath << std::endl;
+            ok = false;
+            continue; // Skip to the next file if this one can't be opened
+        }
+        uint32_t fileIndex = plan != nullptr ? plan->addFile(filePath, source->identity, hashBytes(source->text)) : 0;
+
+        const std::string &text = source->text;
+        size_t lineStart = 0;
+        while (lineStart < text.size())
+        {
+            size_t lineEnd = text.find('\n', lineStart);
+            bool terminated = lineEnd != std::string::npos;
+            if (!terminated) lineEnd = text.size();
+            std::string_view line(text.data() + lineStart, lineEnd - lineStart);
+            if (line.starts_with("#embed ") || line.starts_with("#embed\t"))
+            {
+                std::filesystem::path dataPath;
+                FileIdentity identity;
+                uint64_t contentHash = 0;
+                std::string declaration;
+                if (!embeds.generate(line.substr(6), filePath, sources, dataPath, identity, contentHash, declaration))
+                {
+                    identity = FileIdentity(); // never matches the disk, so the next run reports the error again
+                    ok = false;
+                }
+                bundle += declaration;
+                if (plan != nullptr && !dataPath.empty())
+                {
+                    plan->addFile(dataPath, identity, contentHash);
+                    plan->addLiteral(declaration);
+                }
+            }
+            else if (line.find("#include") == std::string_view::npos)
+            {
+                if (terminated)
+                {
+                    bundle.append(text, lineStart, lineEnd + 1 - lineStart);
+                    if (plan != nullptr) plan->addRange(fileIndex, lineStart, lineEnd + 1 - lineStart);
+                }
+                else
+                {
+                    // The last line has no newline in the file, but always gets one in the bundle
+                    bundle += line;
+                    bundle += '\n';
+                    if (plan != nullptr)
+                    {
+                        plan->addRange(fileIndex, lineStart, line.size());
+                        plan->addLiteral("\n");
+                    }
+                }
+            }
+            lineStart = lineEnd + 1;
+        }
+    }
+    return ok;
+}
+
+// Appends plain values and length-prefixed strings to a byte buffer.
+class BinaryWriter
+{
+public:
+    template <typename T>
+    void write(const T &value)
+    {
+        data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void writeString(std::string_view text)
+    {
+        write<uint64_t>(text.size());
+        data += text;
+    }
+
+    std::string data;
+};
+
+// Reads what BinaryWriter wrote, failing instead of reading past the end.
+class BinaryReader
+{
+public:
+    BinaryReader(const char *data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    bool read(T &value)
+    {
+        if (size - offset < sizeof(T)) return false;
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    bool readString(std::string_view &text)
+    {
+        uint64_t length;
+        if (!read(length) || size - offset < length) return false;
+        text = std::string_view(data + offset, length);
+        offset += length;
+        return true;
+    }
+
+    bool atEnd() const { return offset == size; }
+
+    size_t position() const { return offset; }
+
+    size_t remaining() const { return size - offset; }
+
+private:
+    const char *data;
+    size_t size;
+    size_t offset = 0;
+};
+
+/**
+ * @brief Spells a path for plans, journals and cache keys: relative to the --project-root if
+ * it lies under it, so those stay valid when the checkout moves; otherwise unchanged.
+ */
+std::string projectRelative(const std::filesystem::path &filePath, const std::filesystem::path &projectRoot)
+{
+    if (projectRoot.empty() || !filePath.is_absolute()) return filePath.string();
+    std::filesystem::path relative = filePath.lexically_relative(projectRoot);
+    if (relative.empty() || *relative.begin() == "..") return filePath.string();
+    return relative.generic_string();
+}
+
+const uint64_t emissionPlanMagic = 0x344e4c504c534757; // "WGSLPLN4"
+
+bool writeEmissionPlan(const std::filesystem::path &planPath, const std::string &key, const EmissionPlan &plan,
+                       const std::filesystem::path &projectRoot = {})
+{
+    BinaryWriter writer;
+    writer.write(emissionPlanMagic);
+    writer.writeString(key);
+    writer.write<uint64_t>(plan.files.size());
+    for (size_t i = 0; i < plan.files.size(); i++)
+    {
+        writer.write(plan.identities[i]);
+        writer.write(plan.contentHashes[i]);
+        writer.writeString(projectRelative(plan.files[i], projectRoot));
+    }
+    writer.write(plan.outputIdentity);
+    writer.write(plan.outputHash);
+    writer.write(plan.semanticHash);
+    writer.write<uint8_t>(plan.evaluated);
+    writer.write<uint64_t>(plan.segments.size());
+    writer.data.append(reinterpret_cast<const char *>(plan.segments.data()), plan.segments.size() * sizeof(EmissionSegment));
+    writer.writeString(plan.literals);
+    return writeFileAtomically(planPath, writer.data);
+}
+
+/**
+ * @brief Reads the plan stored next to an output, if it was made with the same key.
+ *
+ * @param planPath The plan file.
+ * @param key Describes the entry and every option that affects the output; empty accepts any.
+ * @param plan Receives the plan.
+ * @param projectRoot The --project-root, which relative paths in the plan are resolved against.
+ * @return True if a plan for this key was loaded.
+ */
+bool loadEmissionPlan(const std::filesystem::path &planPath, const std::string &key, EmissionPlan &plan,
+                      const std::filesystem::path &projectRoot = {})
+{
+    MappedFile mapping;
+    if (!mapping.open(planPath))
+    {
+        return false;
+    }
+    BinaryReader reader(mapping.data(), mapping.size());
+    uint64_t magic = 0;
+    std::string_view storedKey;
+    uint64_t fileCount = 0;
+    if (!reader.read(magic) || magic != emissionPlanMagic || !reader.readString(storedKey) ||
+        (!key.empty() && storedKey != key) || !reader.read(fileCount) ||
+        fileCount > reader.remaining() / (sizeof(FileIdentity) + 2 * sizeof(uint64_t)))
+    {
+        return false;
+    }
+    plan.key = storedKey;
+    for (uint64_t i = 0; i < fileCount; i++)
+    {
+        FileIdentity identity;
+        uint64_t contentHash;
+        std::string_view filePath;
+        if (!reader.read(identity) || !reader.read(contentHash) || !reader.readString(filePath)) return false;
+        plan.addFile(isGeneratedPath(filePath) ? std::filesystem::path(filePath) : projectRoot / std::filesystem::path(filePath),
+                     identity, contentHash);
+    }
+    uint8_t evaluated = 0;
+    if (!reader.read(plan.outputIdentity) || !reader.read(plan.outputHash) || !reader.read(plan.semanticHash) ||
+        !reader.read(evaluated))
+    {
+        return false;
+    }
+    plan.evaluated = evaluated != 0;
+    uint64_t segmentCount = 0;
+    // Counts come from the file: bound them by the bytes left before allocating
+    if (!reader.read(segmentCount) || segmentCount > reader.remaining() / sizeof(EmissionSegment)) return false;
+    plan.segments.resize(segmentCount);
+    for (auto &segment : plan.segments)
+    {
+        if (!reader.read(segment)) return false;
+    }
+    std::string_view literals;
+    if (!reader.readString(literals) || !reader.atEnd()) return false;
+    plan.literals = literals;
+    return true;
+}
+
+/**
+ * @brief Rebuilds a bundle from its plan if none of the plan's inputs changed.
+ *
+ * Plain files are mapped and copied from directly. Segment offsets refer to the text the
+ * plan was made from, so files served by a provider (archive members, compressed and
+ * generated sources) are read back through the source cache instead.
+ *
+ * @param plan The plan loaded by loadEmissionPlan().
+ * @param bundle Receives the bundle.
+ * @param sources The cache provider-backed files are read through.
+ * @return True if the plan was still valid and has been replayed.
+ */
+bool replayEmissionPlan(const EmissionPlan &plan, std::string &bundle, SourceCache &sources)
+{
+    std::vector<bool> unchanged = validateFileIdentities(plan.files, plan.identities);
+    if (std::find(unchanged.begin(), unchanged.end(), false) != unchanged.end())
+    {
+        return false;
+    }
+
+    MemoryTagScope memoryTag(MemoryTag::Output);
+    std::vector<std::unique_ptr<MappedFile>> mappings(plan.files.size());
+    std::vector<std::shared_ptr<const SourceFile>> provided(plan.files.size());
+    std::vector<std::string_view> texts(plan.files.size());
+    bundle.clear();
+    for (const auto &segment : plan.segments)
+    {
+        if (segment.fileIndex == EmissionSegment::literal)
+        {
+            if (segment.offset + segment.length > plan.literals.size()) return false;
+            bundle.append(plan.literals, segment.offset, segment.length);
+            continue;
+        }
+        if (segment.fileIndex >= plan.files.size()) return false;
+        const std::filesystem::path &filePath = plan.files[segment.fileIndex];
+        std::string_view &text = texts[segment.fileIndex];
+        if (sources.providerFor(filePath) != nullptr)
+        {
+            if (!provided[segment.fileIndex] && !(provided[segment.fileIndex] = sources.load(filePath))) return false;
+            text = provided[segment.fileIndex]->text;
+        }
+        else if (!mappings[segment.fileIndex])
+        {
+            mappings[segment.fileIndex] = std::make_unique<MappedFile>();
+            if (!mappings[segment.fileIndex]->open(filePath)) return false;
+            text = std::string_view(mappings[segment.fileIndex]->data(), mappings[segment.fileIndex]->size());
+        }
+        if (segment.offset + segment.length > text.size()) return false;
+        bundle.append(text.data() + segment.offset, segment.length);
+    }
+    return true;
+}
+
+// hashBytes() of a whole file, or 0 if it cannot be read.
+uint64_t hashFileContents(const std::filesystem::path &filePath)
+{
+    MappedFile mapping;
+    if (!mapping.open(filePath))
+    {
+        return 0;
+    }
+    return hashBytes(std::string_view(mapping.data(), mapping.size()));
+}
+
+/**
+ * @brief Verifies that generated outputs are current without regenerating or writing anything.
+ *
+ * Each output's plan records the identity and content hash of every input and of the output
+ * itself. The inputs of all outputs are stat'ed together, each shared header once. A file whose
+ * identity changed (a fresh checkout, a touch) is only then read and compared by content hash.
+ *
+ * @param outputFiles The generated files to check.
+ * @return 0 if every output is current, 1 if any is stale or has no plan.
+ */
+int runCheck(const std::vector<std::string> &outputFiles, const std::filesystem::path &projectRoot)
+{
+    std::vector<EmissionPlan> plans(outputFiles.size());
+    std::vector<bool> hasPlan(outputFiles.size(), false);
+    std::map<std::filesystem::path, size_t> fileIndices;
+    std::vector<std::filesystem::path> files;
+    auto indexOf = [&](const std::filesystem::path &filePath) {
+        auto [entry, inserted] = fileIndices.emplace(filePath, files.size());
+        if (inserted) files.push_back(filePath);
+        return entry->second;
+    };
+    for (size_t i = 0; i < outputFiles.size(); i++)
+    {
+        hasPlan[i] = loadEmissionPlan(outputFiles[i] + ".plan", std::string(), plans[i], projectRoot);
+        indexOf(outputFiles[i]);
+        for (const auto &filePath : plans[i].files)
+        {
+            indexOf(filePath);
+        }
+    }
+
+    std::vector<FileIdentity> identities;
+    std::vector<bool> found = readFileIdentities(files, identities);
+    std::map<size_t, uint64_t> contentHashes; // only filled for files whose identity changed
+    auto contentMatches = [&](size_t index, uint64_t recordedHash) {
+        if (recordedHash == 0) return false;
+        auto hashed = contentHashes.find(index);
+        if (hashed == contentHashes.end()) hashed = contentHashes.emplace(index, hashFileContents(files[index])).first;
+        return hashed->second == recordedHash;
+    };
+
+    size_t staleCount = 0;
+    for (size_t i = 0; i < outputFiles.size(); i++)
+    {
+        const EmissionPlan &plan = plans[i];
+        size_t outputIndex = fileIndices[outputFiles[i]];
+        std::string reason;
+        if (!hasPlan[i])
+        {
+            reason = "no plan recorded";
+        }
+        else if (!found[outputIndex])
+        {
+            reason = "output is missing";
+        }
+        else if (!(identities[outputIndex] == plan.outputIdentity) && !contentMatches(outputIndex, plan.outputHash))
+        {
+            reason = "output was modified";
+        }
+        for (size_t input = 0; reason.empty() && input < plan.files.size(); input++)
+        {
+            size_t index = fileIndices[plan.files[input]];
+            if (!found[index] ||
+                (!(identities[index] == plan.identities[input]) && !contentMatches(index, plan.contentHashes[input])))
+            {
+                reason = plan.files[input].string() + " changed";
+            }
+        }
+        if (!reason.empty())
+        {
+            std::cerr << "Stale: " << outputFiles[i] << ": " << reason << std::endl;
+            staleCount++;
+        }
+    }
+    return staleCount == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Starts reading files a previous run needed, so discovery finds them in the page cache.
+ *
+ * Include graphs rarely change between builds, so the files listed in an old plan are a good
+ * prediction even when the plan itself can no longer be replayed. The hints are issued from a
+ * background thread while findIncludes() runs; the caller joins the returned thread.
+ *
+ * @param files The files expected to be read.
+ * @return The thread issuing the hints (not joinable where readahead is unsupported).
+ */
+std::thread prefetchFiles(std::vector<std::filesystem::path> files)
+{
+#ifdef _WIN32
+    (void)files;
+    return std::thread();
+#else
+    return std::thread([files = std::move(files)]() {
+        for (const auto &filePath : files)
+        {
+            int descriptor = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (descriptor >= 0)
+            {
+                posix_fadvise(descriptor, 0, 0, POSIX_FADV_WILLNEED);
+                close(descriptor);
+            }
+        }
+    });
+#endif
+}
+
+// Everything besides the input files that decides what the bundle looks like.
+std::string emissionKey(const std::filesystem::path &entryPath, const std::string &prefixSnapshotFile, const std::string &options,
+                        const std::filesystem::path &projectRoot = {})
+{
+    return "wgslPreprocessor plan v1\nentry " + projectRelative(entryPath, projectRoot) + "\nprefix " +
+           projectRelative(prefixSnapshotFile, projectRoot) + "\n" + options;
+}
+
+// Everything produced for one entry file.
+struct EntryResult
+{
+    bool ok = false;
+    std::string bundle;
+    std::vector<std::filesystem::path> files; // emission order, excluding prefix files
+    bool prefixReached = false;               // the bundle starts with the prefix snapshot's bytes
+    EmissionPlan plan;                        // how to rebuild the bundle while the inputs are unchanged
+    uint64_t scanNs = 0;                      // time spent in findIncludes()
+};
+
+/**
+ * @brief Finds and orders the files an entry pulls in.
+ *
+ * @param entryPath The canonical path of the entry file.
+ * @param sources The source cache shared by all entries of this process.
+ * @param prefix Optional precompiled prefix to start from.
+ * @param result Receives ok, files, prefixReached and scanNs.
+ */
+void resolveEntry(const std::filesystem::path &entryPath, SourceCache &sources, PrefixSnapshot *prefix, EntryResult &result)
+{
+    std::map<std::filesystem::path, uint32_t> activeIncludes;
+    if (prefix != nullptr)
+    {
+        prefix->reached = false;
+    }
+
+    auto scanStart = std::chrono::steady_clock::now();
+    result.ok = findIncludes(entryPath, entryPath.parent_path(), activeIncludes, 0, sources, prefix);
+    result.scanNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - scanStart).count());
+
+    result.files = convertActiveIncludesToVector(activeIncludes);
+    result.prefixReached = prefix != nullptr && prefix->reached;
+}
+
+/**
+ * @brief Concatenates the files found by resolveEntry() into the bundle and its plan.
+ *
+ * The bundle is assembled even if some include could not be resolved or some #embed failed;
+ * either leaves result.ok false.
+ */
+void assembleEntry(SourceCache &sources, const PrefixSnapshot *prefix, EntryResult &result, EmbedCache *embeds = nullptr)
+{
+    MemoryTagScope memoryTag(MemoryTag::Output);
+    if (result.prefixReached)
+    {
+        // The prefix's bytes stay valid for as long as the snapshot and its files are unchanged
+        result.bundle = prefix->bundle;
+        result.plan.addFile(prefix->snapshotPath, prefix->snapshotIdentity);
+        for (const auto &[prefixFile, identity] : prefix->files)
+        {
+            result.plan.addFile(prefixFile, identity);
+        }
+        result.plan.addLiteral(prefix->bundle);
+    }
+    if (!assembleBundle(result.files, sources, result.bundle, &result.plan, embeds)) result.ok = false;
+}
+
+/**
+ * @brief Resolves and concatenates one entry file.
+ *
+ * @param entryPath The canonical path of the entry file.
+ * @param sources The source cache shared by all entries of this process.
+ * @param prefix Optional precompiled prefix to start from.
+ * @return The bundle and the files it was built from. The bundle is assembled even if some
+ * include could not be resolved or some #embed failed, in which case ok is false.
+ */
+EntryResult preprocessEntry(const std::filesystem::path &entryPath, SourceCache &sources, PrefixSnapshot *prefix)
+{
+    EntryResult result;
+    resolveEntry(entryPath, sources, prefix, result);
+    assembleEntry(sources, prefix, result);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Host-shareable struct layout (WGSL spec "Memory Layout" rules)
+// ---------------------------------------------------------------------------
+
+struct WgslToken
+{
+    std::string text;
+    bool isIdentifier;
+};
+
+// Splits WGSL source into identifiers/numbers and single punctuation characters,
+// dropping line comments and (nestable) block comments.
+std::vector<WgslToken> tokenizeWgsl(const std::string &source)
+{
+    std::vector<WgslToken> tokens;
+    size_t i = 0;
+    while (i < source.size())
+    {
+        char c = source[i];
+        if (c == '/' && i + 1 < source.size() && source[i + 1] == '/')
+        {
+            while (i < source.size() && source[i] != '\n') i++;
+        }
+        else if (c == '/' && i + 1 < source.size() && source[i + 1] == '*')
+        {
+            int nesting = 0;
+            do
+            {
+                if (source.compare(i, 2, "/*") == 0) { nesting++; i += 2; }
+                else if (source.compare(i, 2, "*/") == 0) { nesting--; i += 2; }
+                else i++;
+            } while (nesting > 0 && i < source.size());
+        }
+        else if (std::isalnum(static_cast<unsigned char>(c)) || c == '_')
+        {
+            size_t start = i;
+            while (i < source.size() && (std::isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_' || source[i] == '.')) i++;
+            tokens.push_back({source.substr(start, i - start), true});
+        }
+        else if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            i++;
+        }
+        else
+        {
+            tokens.push_back({std::string(1, c), false});
+            i++;
+        }
+    }
+    return tokens;
+}
+
+/**
+ * @brief Hashes WGSL source so that only edits that change its meaning change the result.
+ *
+ * Comments are dropped like in tokenizeWgsl() and each run of whitespace is either dropped or,
+ * where it keeps two tokens apart (between word characters, or between punctuation that could
+ * otherwise read as one operator, e.g. "- -" versus "--"), replaced by a single space.
+ */
+uint64_t semanticFingerprint(std::string_view source)
+{
+    auto isWordChar = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.'; };
+    std::string normalized;
+    normalized.reserve(source.size());
+    bool separated = false;
+    size_t i = 0;
+    while (i < source.size())
+    {
+        char c = source[i];
+        if (c == '/' && i + 1 < source.size() && source[i + 1] == '/')
+        {
+            while (i < source.size() && source[i] != '\n') i++;
+            separated = true;
+        }
+        else if (c == '/' && i + 1 < source.size() && source[i + 1] == '*')
+        {
+            int nesting = 0;
+            do
+            {
+                if (source.compare(i, 2, "/*") == 0) { nesting++; i += 2; }
+                else if (source.compare(i, 2, "*/") == 0) { nesting--; i += 2; }
+                else i++;
+            } while (nesting > 0 && i < source.size());
+            separated = true;
+        }
+        else if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            i++;
+            separated = true;
+        }
+        else
+        {
+            if (separated && !normalized.empty() && isWordChar(normalized.back()) == isWordChar(c))
+            {
+                normalized += ' ';
+            }
+            normalized += c;
+            separated = false;
+            i++;
+        }
+    }
+    return hashBytes(normalized);
+}
+
+struct WgslType
+{
+    std::string name;                // f32, vec3, mat4x4, array, atomic, or a struct/alias name
+    std::vector<WgslType> params;    // template parameters (element type etc.)
+    std::string count;               // array element count, empty for runtime-sized arrays
+};
+
+struct WgslMember
+{
+    std::string name;
+    WgslType type;
+    uint32_t alignAttribute = 0;
+    uint32_t sizeAttribute = 0;
+};
+
+struct WgslStruct
+{
+    std::string name;
+    std::vector<WgslMember> members;
+};
+
+struct WgslDeclarations
+{
+    std::vector<WgslStruct> structs;                 // in declaration order
+    std::map<std::string, WgslType> aliases;
+    std::map<std::string, std::string> constants;    // const NAME = <literal>;
+};
+
+// Parses "ident" or "ident<type, ...>" starting at pos.
+bool parseWgslType(const std::vector<WgslToken> &tokens, size_t &pos, WgslType &type)
+{
+    if (pos >= tokens.size() || !tokens[pos].isIdentifier) return false;
+    type.name = tokens[pos++].text;
+    if (pos < tokens.size() && tokens[pos].text == "<")
+    {
+        pos++;
+        while (pos < tokens.size() && tokens[pos].text != ">")
+        {
+            if (type.name == "array" && !type.params.empty())
+            {
+                // Element count: a literal or the name of a const, possibly suffixed (4u, 4i)
+                if (!tokens[pos].isIdentifier) return false;
+                type.count = tokens[pos++].text;
+            }
+            else
+            {
+                WgslType param;
+                if (!parseWgslType(tokens, pos, param)) return false;
+                type.params.push_back(param);
+            }
+            if (pos < tokens.size() && tokens[pos].text == ",") pos++;
+        }
+        if (pos >= tokens.size()) return false;
+        pos++; // '>'
+    }
+    return true;
+}
+
+// Parses an attribute argument such as the 16 in @align(16).
+uint32_t parseAttributeValue(const std::vector<WgslToken> &tokens, size_t &pos)
+{
+    uint32_t value = 0;
+    if (pos + 2 < tokens.size() && tokens[pos].text == "(" && tokens[pos + 2].text == ")")
+    {
+        value = static_cast<uint32_t>(std::strtoul(tokens[pos + 1].text.c_str(), nullptr, 0));
+        pos += 3;
+    }
+    return value;
+}
+
+WgslDeclarations parseWgslDeclarations(const std::string &source)
+{
+    std::vector<WgslToken> tokens = tokenizeWgsl(source);
+    WgslDeclarations declarations;
+    size_t pos = 0;
+    while (pos < tokens.size())
+    {
+        const std::string &keyword = tokens[pos].text;
+        if (keyword == "struct" && pos + 2 < tokens.size() && tokens[pos + 2].text == "{")
+        {
+            WgslStruct wgslStruct;
+            wgslStruct.name = tokens[pos + 1].text;
+            pos += 3;
+            WgslMember member;
+            while (pos < tokens.size() && tokens[pos].text != "}")
+            {
+                if (tokens[pos].text == "@" && pos + 1 < tokens.size())
+                {
+                    std::string attribute = tokens[pos + 1].text;
+                    pos += 2;
+                    if (attribute == "align") member.alignAttribute = parseAttributeValue(tokens, pos);
+                    else if (attribute == "size") member.sizeAttribute = parseAttributeValue(tokens, pos);
+                    else if (pos < tokens.size() && tokens[pos].text == "(")
+                    {
+                        while (pos < tokens.size() && tokens[pos].text != ")") pos++;
+                        pos++;
+                    }
+                }
+                else if (tokens[pos].isIdentifier && pos + 1 < tokens.size() && tokens[pos + 1].text == ":")
+                {
+                    member.name = tokens[pos].text;
+                    pos += 2;
+                    if (!parseWgslType(tokens, pos, member.type)) break;
+                    wgslStruct.members.push_back(member);
+                    member = WgslMember();
+                }
+                else
+                {
+                    pos++; // ',' or ';' between members
+                }
+            }
+            pos++;
+            declarations.structs.push_back(wgslStruct);
+        }
+        else if (keyword == "alias" && pos + 2 < tokens.size() && tokens[pos + 2].text == "=")
+        {
+            std::string name = tokens[pos + 1].text;
+            pos += 3;
+            WgslType type;
+            if (parseWgslType(tokens, pos, type)) declarations.aliases[name] = type;
+        }
+        else if (keyword == "const" && pos + 1 < tokens.size() && tokens[pos + 1].isIdentifier)
+        {
+            std::string name = tokens[pos + 1].text;
+            pos += 2;
+            while (pos < tokens.size() && tokens[pos].text != "=" && tokens[pos].text != ";") pos++;
+            if (pos + 2 < tokens.size() && tokens[pos].text == "=" && tokens[pos + 1].isIdentifier && tokens[pos + 2].text == ";")
+            {
+                declarations.constants[name] = tokens[pos + 1].text;
+            }
+        }
+        else
+        {
+            pos++;
+        }
+    }
+    return declarations;
+}
+
+uint32_t roundUp(uint32_t alignment, uint32_t value)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Layout of one WGSL type, plus how to spell it as a C++ member declarator.
+struct HostLayout
+{
+    uint32_t align = 0;
+    uint32_t size = 0;
+    bool runtimeSized = false;
+    std::string cppType;             // float, std::uint32_t, or a generated struct name
+    std::vector<uint32_t> extents;   // C++ array extents, outermost first
+};
+
+class LayoutCalculator
+{
+public:
+    explicit LayoutCalculator(const WgslDeclarations &declarations) : declarations(declarations) {}
+
+    static bool isDimension(char c)
+    {
+        return c >= '2' && c <= '4';
+    }
+
+    // vecN, or vecN plus a one-letter scalar suffix when size is 5
+    static bool isVectorName(const std::string &name, size_t size)
+    {
+        return name.size() == size && name.rfind("vec", 0) == 0 && isDimension(name[3]);
+    }
+
+    // matCxR, or matCxR plus a one-letter scalar suffix when size is 7
+    static bool isMatrixName(const std::string &name, size_t size)
+    {
+        return name.size() == size && name.rfind("mat", 0) == 0 && isDimension(name[3]) && name[4] == 'x' && isDimension(name[5]);
+    }
+
+    bool compute(const WgslType &type, HostLayout &layout, std::string &error)
+    {
+        std::string name = type.name;
+        WgslType element = type.params.empty() ? WgslType() : type.params[0];
+
+        auto alias = declarations.aliases.find(name);
+        if (alias != declarations.aliases.end()) return compute(alias->second, layout, error);
+
+        // User structs first: a name such as material only looks like a matrix shorthand
+        for (const auto &wgslStruct : declarations.structs)
+        {
+            if (wgslStruct.name == name)
+            {
+                std::vector<uint32_t> offsets;
+                return computeStruct(wgslStruct, layout, offsets, error);
+            }
+        }
+
+        // Predeclared shorthands: vec3f, vec4i, mat4x4f, vec2h, ...
+        if (type.params.empty() && (isVectorName(name, 5) || isMatrixName(name, 7)))
+        {
+            char suffix = name.back();
+            bool matrix = name[0] == 'm';
+            const char *scalar = suffix == 'f' ? "f32" : suffix == 'h' ? "f16" : matrix ? nullptr : suffix == 'i' ? "i32" : suffix == 'u' ? "u32" : nullptr;
+            if (scalar != nullptr)
+            {
+                name.pop_back();
+                element = WgslType{scalar, {}, {}};
+            }
+        }
+
+        if (name == "f32" || name == "i32" || name == "u32" || name == "f16")
+        {
+            layout.align = layout.size = name == "f16" ? 2 : 4;
+            layout.cppType = name == "f32" ? "float" : name == "i32" ? "std::int32_t" : name == "u32" ? "std::uint32_t" : "std::uint16_t";
+            return true;
+        }
+        if (name == "atomic")
+        {
+            return compute(element, layout, error);
+        }
+        if (isVectorName(name, 4))
+        {
+            uint32_t components = static_cast<uint32_t>(name[3] - '0');
+            HostLayout scalar;
+            if (!compute(element, scalar, error)) return false;
+            layout = scalar;
+            layout.size = components * scalar.size;
+            layout.align = (components == 2 ? 2 : 4) * scalar.size;
+            layout.extents = {components};
+            return true;
+        }
+        if (isMatrixName(name, 6))
+        {
+            // matCxR is laid out as an array of C column vectors vecR
+            uint32_t columns = static_cast<uint32_t>(name[3] - '0');
+            uint32_t rows = static_cast<uint32_t>(name[5] - '0');
+            HostLayout column;
+            if (!compute(WgslType{"vec" + std::to_string(rows), {element}, {}}, column, error)) return false;
+            uint32_t stride = roundUp(column.align, column.size);
+            layout = column;
+            layout.size = columns * stride;
+            layout.extents = {columns, stride / (column.size / rows)};
+            return true;
+        }
+        if (name == "array")
+        {
+            HostLayout elementLayout;
+            if (!compute(element, elementLayout, error)) return false;
+            if (elementLayout.runtimeSized)
+            {
+                error = "array of runtime-sized type";
+                return false;
+            }
+            uint32_t stride = roundUp(elementLayout.align, elementLayout.size);
+            if (elementLayout.extents.size() == 1 && stride != elementLayout.size)
+            {
+                // vec3 elements: pad each element out to the array stride
+                elementLayout.extents[0] = stride / (elementLayout.size / elementLayout.extents[0]);
+            }
+            layout = elementLayout;
+            if (type.count.empty())
+            {
+                layout.runtimeSized = true;
+                layout.size = stride; // stride of the runtime-sized array
+                return true;
+            }
+            uint32_t count = 0;
+            if (!evaluateCount(type.count, count))
+            {
+                error = "cannot evaluate array count " + type.count;
+                return false;
+            }
+            layout.size = count * stride;
+            layout.extents.insert(layout.extents.begin(), count);
+            return true;
+        }
+        error = "type " + name + " is not host-shareable";
+        return false;
+    }
+
+    bool computeStruct(const WgslStruct &wgslStruct, HostLayout &layout, std::vector<uint32_t> &offsets, std::string &error)
+    {
+        if (inProgress.count(wgslStruct.name))
+        {
+            error = "recursive struct " + wgslStruct.name;
+            return false;
+        }
+        inProgress.insert(wgslStruct.name);
+        uint32_t offset = 0;
+        uint32_t structAlign = 1;
+        layout.runtimeSized = false;
+        for (size_t i = 0; i < wgslStruct.members.size(); i++)
+        {
+            const WgslMember &member = wgslStruct.members[i];
+            HostLayout memberLayout;
+            if (!compute(member.type, memberLayout, error))
+            {
+                inProgress.erase(wgslStruct.name);
+                return false;
+            }
+            if (memberLayout.runtimeSized && i + 1 != wgslStruct.members.size())
+            {
+                error = "runtime-sized array must be the last member of " + wgslStruct.name;
+                inProgress.erase(wgslStruct.name);
+                return false;
+            }
+            uint32_t memberAlign = member.alignAttribute ? member.alignAttribute : memberLayout.align;
+            uint32_t memberSize = member.sizeAttribute ? member.sizeAttribute : memberLayout.size;
+            offset = roundUp(memberAlign, offset);
+            offsets.push_back(offset);
+            structAlign = std::max(structAlign, memberAlign);
+            layout.runtimeSized = memberLayout.runtimeSized;
+            offset += memberLayout.runtimeSized ? 0 : memberSize;
+        }
+        inProgress.erase(wgslStruct.name);
+        layout.align = structAlign;
+        layout.size = roundUp(structAlign, offset);
+        layout.cppType = wgslStruct.name;
+        layout.extents.clear();
+        return true;
+    }
+
+private:
+    bool evaluateCount(const std::string &text, uint32_t &count)
+    {
+        auto constant = declarations.constants.find(text);
+        const std::string &literal = constant != declarations.constants.end() ? constant->second : text;
+        char *end = nullptr;
+        unsigned long value = std::strtoul(literal.c_str(), &end, 0);
+        if (end == literal.c_str() || (*end != '\0' && std::string(end) != "u" && std::string(end) != "i")) return false;
+        count = static_cast<uint32_t>(value);
+        return true;
+    }
+
+    const WgslDeclarations &declarations;
+    std::set<std::string> inProgress;
+};
+
+std::string cppMemberName(const std::string &name)
+{
+    static const std::set<std::string> keywords = {
+        "auto", "bool", "break", "case", "char", "class", "const", "default", "delete", "do", "double", "else",
+        "enum", "float", "for", "friend", "if", "int", "long", "namespace", "new", "operator", "private",
+        "protected", "public", "register", "return", "short", "signed", "sizeof", "static", "struct", "switch",
+        "template", "this", "throw", "try", "typedef", "union", "unsigned", "using", "virtual", "void", "while",
+        "and", "and_eq", "bitand", "bitor", "compl", "not", "not_eq", "or", "or_eq", "xor", "xor_eq"};
+    return keywords.count(name) ? name + "_" : name;
+}
+
+// Returns the structs ordered so every struct follows the structs its members use. WGSL
+// allows a struct to be used before its declaration; C++ does not.
+std::vector<const WgslStruct *> structsInDependencyOrder(const WgslDeclarations &declarations)
+{
+    std::map<std::string, const WgslStruct *> byName;
+    for (const auto &wgslStruct : declarations.structs) byName[wgslStruct.name] = &wgslStruct;
+
+    std::vector<const WgslStruct *> ordered;
+    std::set<std::string> visited;
+    std::function<void(const WgslStruct &)> visit;
+    std::function<void(const WgslType &, int)> visitType = [&](const WgslType &type, int depth)
+    {
+        if (depth > 64) return; // alias cycle; the layout calculator reports it
+        auto alias = declarations.aliases.find(type.name);
+        if (alias != declarations.aliases.end()) visitType(alias->second, depth + 1);
+        auto used = byName.find(type.name);
+        if (used != byName.end()) visit(*used->second);
+        for (const auto &param : type.params) visitType(param, depth + 1);
+    };
+    visit = [&](const WgslStruct &wgslStruct)
+    {
+        if (!visited.insert(wgslStruct.name).second) return; // done, or recursive (reported later)
+        for (const auto &member : wgslStruct.members) visitType(member.type, 0);
+        ordered.push_back(&wgslStruct);
+    };
+    for (const auto &wgslStruct : declarations.structs) visit(wgslStruct);
+    return ordered;
+}
+
+/**
+ * @brief Writes a C++ header mirroring every host-shareable struct in the bundle.
+ *
+ * Offsets, alignment and sizes follow the WGSL memory layout rules. Gaps are spelled out
+ * as explicit padding members and every offset is checked with a static_assert, so the
+ * C++ structs can be memcpy'd straight into uniform and storage buffers.
+ *
+ * @param bundle The preprocessed shader source.
+ * @param headerPath Where to write the generated header.
+ * @param sourceName The entry file name, recorded in the header comment.
+ * @return True if the header was written, false otherwise.
+ */
+bool writeLayoutHeader(const std::string &bundle, const std::filesystem::path &headerPath, const std::string &sourceName)
+{
+    WgslDeclarations declarations = parseWgslDeclarations(bundle);
+    LayoutCalculator calculator(declarations);
+
+    std::ostringstream header;
+    header << "// Generated by wgslPreprocessor from " << sourceName << ". Do not edit.\n"
+           << "#pragma once\n\n#include <cstddef>\n#include <cstdint>\n";
+
+    for (const WgslStruct *structPointer : structsInDependencyOrder(declarations))
+    {
+        const WgslStruct &wgslStruct = *structPointer;
+        HostLayout layout;
+        std::vector<uint32_t> offsets;
+        std::string error;
+        if (!calculator.computeStruct(wgslStruct, layout, offsets, error))
+        {
+            std::cerr << "Warning: Skipping layout for struct " << wgslStruct.name << ": " << error << std::endl;
+            continue;
+        }
+
+        std::ostringstream body;
+        std::ostringstream asserts;
+        uint32_t cursor = 0;
+        uint32_t paddingCount = 0;
+        for (size_t i = 0; i < wgslStruct.members.size(); i++)
+        {
+            const WgslMember &member = wgslStruct.members[i];
+            HostLayout memberLayout;
+            calculator.compute(member.type, memberLayout, error);
+            std::string memberName = cppMemberName(member.name);
+            if (offsets[i] > cursor)
+            {
+                body << "    std::uint8_t _pad" << paddingCount++ << "[" << offsets[i] - cursor << "];\n";
+            }
+            if (memberLayout.runtimeSized)
+            {
+                // C++ has no flexible array members; expose the tail's placement instead
+                body << "    // " << member.name << ": runtime-sized array starting at offset " << offsets[i] << "\n"
+                     << "    static constexpr std::size_t " << memberName << "_offset = " << offsets[i] << ";\n"
+                     << "    static constexpr std::size_t " << memberName << "_stride = " << memberLayout.size << ";\n";
+                cursor = offsets[i];
+                continue;
+            }
+            body << "    " << memberLayout.cppType << " " << memberName;
+            for (uint32_t extent : memberLayout.extents) body << "[" << extent << "]";
+            body << ";\n";
+            asserts << "static_assert(offsetof(" << wgslStruct.name << ", " << memberName << ") == " << offsets[i] << ");\n";
+            cursor = offsets[i] + memberLayout.size; // any @size slack is padded before the next member
+        }
+        if (layout.size > cursor)
+        {
+            body << "    std::uint8_t _pad" << paddingCount++ << "[" << layout.size - cursor << "];\n";
+        }
+
+        header << "\nstruct alignas(" << layout.align << ") " << wgslStruct.name << "\n{\n" << body.str() << "};\n"
+               << asserts.str()
+               << "static_assert(sizeof(" << wgslStruct.name << ") == " << layout.size << ");\n";
+    }
+
+    std::ofstream headerFile(headerPath);
+    if (!headerFile.is_open())
+    {
+        std::cerr << "Error: Could not open layout header: " << headerPath << std::endl;
+        return false;
+    }
+    headerFile << header.str();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Precompiled prefix snapshots
+//
+// File layout (native endianness, everything 8-byte aligned so the mapping can be read in place):
+//   PrefixSnapshotHeader
+//   PrefixSnapshotRecord[fileCount]   in emission order
+//   path bytes                        concatenated, lengths in the records
+//   bundle bytes                      the prefix's emitted text
+// ---------------------------------------------------------------------------
+
+const char prefixSnapshotMagic[8] = {'W', 'G', 'S', 'L', 'P', 'F', 'X', '1'};
+
+struct PrefixSnapshotHeader
+{
+    char magic[8];
+    uint32_t fileCount;
+    uint32_t reserved;
+    uint64_t pathBytes;
+    uint64_t bundleSize;
+};
+
+struct PrefixSnapshotRecord
+{
+    FileIdentity identity;
+    uint64_t pathLength;
+};
+
+bool writePrefixSnapshot(const std::filesystem::path &snapshotPath,
+                         const std::vector<std::filesystem::path> &files,
+                         const std::string &bundle)
+{
+    std::vector<PrefixSnapshotRecord> records;
+    std::string paths;
+    for (const auto &filePath : files)
+    {
+        PrefixSnapshotRecord record{};
+        if (!readFileIdentity(filePath, record.identity))
+        {
+            std::cerr << "Error: Could not stat prefix file: " << filePath << std::endl;
+            return false;
+        }
+        record.pathLength = filePath.string().size();
+        paths += filePath.string();
+        records.push_back(record);
+    }
+    paths.resize(roundUp(8, static_cast<uint32_t>(paths.size())), '\0');
+
+    PrefixSnapshotHeader header{};
+    std::memcpy(header.magic, prefixSnapshotMagic, sizeof(header.magic));
+    header.fileCount = static_cast<uint32_t>(records.size());
+    header.pathBytes = paths.size();
+    header.bundleSize = bundle.size();
+
+    std::ofstream snapshotFile(snapshotPath, std::ios::binary);
+    if (!snapshotFile.is_open())
+    {
+        std::cerr << "Error: Could not open prefix snapshot for writing: " << snapshotPath << std::endl;
+        return false;
+    }
+    snapshotFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    snapshotFile.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(PrefixSnapshotRecord)));
+    snapshotFile.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+    snapshotFile.write(bundle.data(), static_cast<std::streamsize>(bundle.size()));
+    return snapshotFile.good();
+}
+
+/**
+ * @brief Maps a prefix snapshot and checks that none of its files changed since it was written.
+ *
+ * @param snapshotPath The snapshot written by --write-prefix.
+ * @param prefix Receives the file set and a view of the emitted bytes (backed by the mapping).
+ * @return True if the snapshot is usable, false if it is missing, corrupt or stale.
+ */
+bool loadPrefixSnapshot(const std::filesystem::path &snapshotPath, PrefixSnapshot &prefix)
+{
+    if (!prefix.mapping.open(snapshotPath))
+    {
+        std::cerr << "Warning: Could not open prefix snapshot: " << snapshotPath << std::endl;
+        return false;
+    }
+    const char *data = prefix.mapping.data();
+    size_t size = prefix.mapping.size();
+
+    PrefixSnapshotHeader header;
+    if (size < sizeof(header))
+    {
+        std::cerr << "Warning: Prefix snapshot is truncated: " << snapshotPath << std::endl;
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    size_t recordsEnd = sizeof(header) + static_cast<size_t>(header.fileCount) * sizeof(PrefixSnapshotRecord);
+    if (std::memcmp(header.magic, prefixSnapshotMagic, sizeof(header.magic)) != 0 ||
+        size != recordsEnd + header.pathBytes + header.bundleSize)
+    {
+        std::cerr << "Warning: Not a valid prefix snapshot: " << snapshotPath << std::endl;
+        return false;
+    }
+
+    const char *pathCursor = data + recordsEnd;
+    std::vector<std::filesystem::path> files;
+    std::vector<FileIdentity> identities;
+    for (uint32_t i = 0; i < header.fileCount; i++)
+    {
+        PrefixSnapshotRecord record;
+        std::memcpy(&record, data + sizeof(header) + i * sizeof(PrefixSnapshotRecord), sizeof(record));
+        files.emplace_back(std::string(pathCursor, record.pathLength));
+        identities.push_back(record.identity);
+        pathCursor += record.pathLength;
+    }
+    std::vector<bool> unchanged = validateFileIdentities(files, identities);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!unchanged[i])
+        {
+            std::cerr << "Warning: Prefix snapshot is stale (" << files[i] << " changed), resolving without it" << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        prefix.files[files[i]] = identities[i];
+    }
+    prefix.snapshotPath = snapshotPath;
+    readFileIdentity(snapshotPath, prefix.snapshotIdentity);
+    prefix.bundle = std::string_view(data + recordsEnd + header.pathBytes, header.bundleSize);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Conditional blocks
+//
+// With -D (or --axis) the bundle's #if/#ifdef/#ifndef/#elif/#else/#endif blocks are resolved
+// before it is written; without them they pass through untouched as before. Conditions use the
+// C preprocessor's rules: integers, names (a name without a value is 0), defined(NAME), !, the
+// comparison operators, && and ||. A -D without a value defines the name as 1.
+// Includes are resolved before conditions, so an #include inside a block is always pulled in.
+//
+// --residual evaluates partially: only names given with -D or -U are known, and blocks that
+// depend on any other name stay in the output with their conditions folded as far as possible.
+// The result has no includes left, so a later stage can finish it quickly with the rest.
+// ---------------------------------------------------------------------------
+
+// A condition's value, or unknown where it depends on a define that is decided later. An unknown
+// value carries the residual condition: the original with every known part folded.
+struct ConditionValue
+{
+    bool known = true;
+    int64_t value = 0;
+    std::string residual;
+    bool boolean = false; // residual always yields 0 or 1
+    bool atomic = true;   // residual needs no parentheses as an operand
+
+    static ConditionValue knownValue(int64_t value)
+    {
+        return {true, value, std::string(), false, true};
+    }
+
+    static ConditionValue unknownValue(std::string residual, bool boolean, bool atomic)
+    {
+        return {false, 0, std::move(residual), boolean, atomic};
+    }
+
+    std::string operand() const
+    {
+        if (known) return std::to_string(value);
+        return atomic ? residual : "(" + residual + ")";
+    }
+
+    // The value as a truth value: 0 or 1, or a residual that yields 0 or 1.
+    ConditionValue truth() const
+    {
+        if (known) return knownValue(value != 0 ? 1 : 0);
+        return boolean ? *this : unknownValue("!!" + operand(), true, true);
+    }
+};
+
+// The defines conditions are evaluated against.
+struct DefineSet
+{
+    std::map<std::string, std::string> values;  // -D NAME[=VALUE]
+    std::set<std::string> undefined;             // -U NAME: known to stay undefined
+    std::set<std::string> unknown;               // names whose value is not decided yet
+    bool othersUnknown = false;                  // --residual: names in none of the above are not decided yet
+    std::set<std::string> *references = nullptr; // collects the names reachable conditions depend on
+
+    bool isUnknown(const std::string &name) const
+    {
+        return unknown.count(name) || (othersUnknown && !values.count(name) && !undefined.count(name));
+    }
+
+    ConditionValue lookup(const std::string &name, bool record) const
+    {
+        if (record && references != nullptr) references->insert(name);
+        if (isUnknown(name)) return ConditionValue::unknownValue(name, false, true);
+        auto defined = values.find(name);
+        return ConditionValue::knownValue(defined == values.end() ? 0 : std::strtoll(defined->second.c_str(), nullptr, 0));
+    }
+
+    ConditionValue isDefined(const std::string &name, bool record) const
+    {
+        if (record && references != nullptr) references->insert(name);
+        if (isUnknown(name)) return ConditionValue::unknownValue("defined(" + name + ")", true, true);
+        return ConditionValue::knownValue(values.count(name) ? 1 : 0);
+    }
+
+    // Part of the emission key: a plan only replays for the defines it was made with.
+    std::string describe() const
+    {
+        std::string text;
+        for (const auto &[name, value] : values)
+        {
+            text += "define " + name + "=" + value + "\n";
+        }
+        for (const auto &name : undefined)
+        {
+            text += "undefine " + name + "\n";
+        }
+        return text + (othersUnknown ? "residual\n" : "");
+    }
+};
+
+/**
+ * @brief Evaluates one #if/#elif condition by recursive descent.
+ *
+ * Operands that a short-circuit makes irrelevant are parsed without recording their names, so
+ * "#if FAST || QUALITY > 2" with FAST=1 does not make QUALITY relevant.
+ */
+class ConditionParser
+{
+public:
+    ConditionParser(std::string_view text, const DefineSet &defines) : text(text), defines(defines) {}
+
+    bool parse(ConditionValue &result)
+    {
+        result = parseOr(true);
+        skipSpace();
+        return valid && position == text.size();
+    }
+
+private:
+    ConditionValue parseOr(bool record)
+    {
+        ConditionValue left = parseAnd(record);
+        while (consume("||"))
+        {
+            bool decided = left.known && left.value != 0;
+            ConditionValue right = parseAnd(record && !decided);
+            if (decided || (right.known && right.value != 0)) left = ConditionValue::knownValue(1);
+            else if (left.known) left = right.truth();   // left is 0
+            else if (right.known) left = left.truth();   // right is 0
+            else left = ConditionValue::unknownValue(left.operand() + " || " + right.operand(), true, false);
+        }
+        return left;
+    }
+
+    ConditionValue parseAnd(bool record)
+    {
+        ConditionValue left = parseComparison(record);
+        while (consume("&&"))
+        {
+            bool decided = left.known && left.value == 0;
+            ConditionValue right = parseComparison(record && !decided);
+            if (decided || (right.known && right.value == 0)) left = ConditionValue::knownValue(0);
+            else if (left.known) left = right.truth();   // left is non-zero
+            else if (right.known) left = left.truth();   // right is non-zero
+            else left = ConditionValue::unknownValue(left.operand() + " && " + right.operand(), true, false);
+        }
+        return left;
+    }
+
+    ConditionValue parseComparison(bool record)
+    {
+        ConditionValue left = parseUnary(record);
+        while (true)
+        {
+            std::string_view op;
+            for (std::string_view candidate : {"==", "!=", "<=", ">=", "<", ">"})
+            {
+                if (consume(candidate))
+                {
+                    op = candidate;
+                    break;
+                }
+            }
+            if (op.empty()) return left;
+            ConditionValue right = parseUnary(record);
+            if (!left.known || !right.known)
+            {
+                left = ConditionValue::unknownValue(left.operand() + " " + std::string(op) + " " + right.operand(), true, false);
+                continue;
+            }
+            bool holds = op == "==" ? left.value == right.value
+                       : op == "!=" ? left.value != right.value
+                       : op == "<=" ? left.value <= right.value
+                       : op == ">=" ? left.value >= right.value
+                       : op == "<"  ? left.value < right.value
+                                    : left.value > right.value;
+            left = ConditionValue::knownValue(holds ? 1 : 0);
+        }
+    }
+
+    ConditionValue parseUnary(bool record)
+    {
+        skipSpace();
+        if (position < text.size() && text[position] == '!' && !lookingAt("!="))
+        {
+            position++;
+            ConditionValue operand = parseUnary(record);
+            if (operand.known) return ConditionValue::knownValue(operand.value == 0 ? 1 : 0);
+            return ConditionValue::unknownValue("!" + operand.operand(), true, true);
+        }
+        return parsePrimary(record);
+    }
+
+    ConditionValue parsePrimary(bool record)
+    {
+        skipSpace();
+        if (consume("("))
+        {
+            ConditionValue inner = parseOr(record);
+            if (!consume(")")) valid = false;
+            return inner;
+        }
+        if (position < text.size() && std::isdigit(static_cast<unsigned char>(text[position])))
+        {
+            size_t start = position;
+            while (position < text.size() && std::isalnum(static_cast<unsigned char>(text[position]))) position++;
+            return ConditionValue::knownValue(std::strtoll(std::string(text.substr(start, position - start)).c_str(), nullptr, 0));
+        }
+        std::string name = identifier();
+        if (name.empty())
+        {
+            valid = false;
+            return ConditionValue::knownValue(0);
+        }
+        if (name != "defined")
+        {
+            return defines.lookup(name, record);
+        }
+        bool parenthesized = consume("(");
+        std::string definedName = identifier();
+        if (definedName.empty() || (parenthesized && !consume(")"))) valid = false;
+        return defines.isDefined(definedName, record);
+    }
+
+    std::string identifier()
+    {
+        skipSpace();
+        size_t start = position;
+        while (position < text.size() && (std::isalnum(static_cast<unsigned char>(text[position])) || text[position] == '_')) position++;
+        if (start < text.size() && std::isdigit(static_cast<unsigned char>(text[start]))) position = start;
+        return std::string(text.substr(start, position - start));
+    }
+
+    bool lookingAt(std::string_view token) const { return text.compare(position, token.size(), token) == 0; }
+
+    bool consume(std::string_view token)
+    {
+        skipSpace();
+        if (!lookingAt(token)) return false;
+        position += token.size();
+        return true;
+    }
+
+    void skipSpace()
+    {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) position++;
+    }
+
+    std::string_view text;
+    const DefineSet &defines;
+    size_t position = 0;
+    bool valid = true;
+};
+
+// Splits "#name rest" into the directive name and its argument; false for any other line.
+bool parseDirective(std::string_view line, std::string_view &name, std::string_view &argument)
+{
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string_view::npos || line[start] != '#') return false;
+    size_t nameStart = line.find_first_not_of(" \t", start + 1);
+    if (nameStart == std::string_view::npos) return false;
+    size_t nameEnd = nameStart;
+    while (nameEnd < line.size() && std::isalpha(static_cast<unsigned char>(line[nameEnd]))) nameEnd++;
+    name = line.substr(nameStart, nameEnd - nameStart);
+    argument = line.substr(nameEnd);
+    while (!argument.empty() && std::isspace(static_cast<unsigned char>(argument.back()))) argument.remove_suffix(1);
+    return name == "if" || name == "ifdef" || name == "ifndef" || name == "elif" || name == "else" || name == "endif";
+}
+
+ConditionValue evaluateDirective(std::string_view name, std::string_view argument, const DefineSet &defines)
+{
+    std::string condition(argument);
+    if (name == "ifdef") condition = "defined(" + condition + ")";
+    else if (name == "ifndef") condition = "!defined(" + condition + ")";
+
+    ConditionValue value;
+    ConditionParser parser(condition, defines);
+    if (!parser.parse(value))
+    {
+        std::cerr << "Warning: Malformed condition treated as false: #" << name << argument << std::endl;
+        return ConditionValue::knownValue(0);
+    }
+    return value;
+}
+
+/**
+ * @brief Keeps the lines of the taken branches and drops the directives that were decided.
+ *
+ * A branch whose condition is unknown is kept. With keepUnknown its directive is kept too,
+ * reduced to the residual condition, which yields a smaller source a later run can finish with
+ * the remaining defines. Without it the branch is kept as if taken, which is what the relevance
+ * analysis needs: everything some value of the unknown defines could reach is visited.
+ *
+ * @param bundle The assembled bundle, one '\n'-terminated line at a time.
+ * @param defines The defines to evaluate against; references, if set, collects the names of
+ * every define a reachable condition depended on.
+ * @param keepUnknown True to emit residual #if/#elif/#else/#endif for undecided blocks.
+ */
+std::string applyConditionals(std::string_view bundle, const DefineSet &defines, bool keepUnknown = false)
+{
+    struct Block
+    {
+        bool parentLive;   // lines around the block are kept
+        bool taken;        // a branch known to be true was seen
+        bool live;         // lines of the current branch are kept
+        bool emitted;      // a residual #if was written for this block
+    };
+    std::vector<Block> blocks;
+    std::string result;
+    result.reserve(bundle.size());
+
+    size_t lineStart = 0;
+    while (lineStart < bundle.size())
+    {
+        size_t lineEnd = bundle.find('\n', lineStart);
+        lineEnd = lineEnd == std::string_view::npos ? bundle.size() : lineEnd + 1;
+        std::string_view line = bundle.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd;
+
+        bool live = blocks.empty() || blocks.back().live;
+        std::string_view name;
+        std::string_view argument;
+        if (!parseDirective(line, name, argument))
+        {
+            if (live) result += line;
+            continue;
+        }
+
+        bool opening = name == "if" || name == "ifdef" || name == "ifndef";
+        if (opening)
+        {
+            blocks.push_back({live, false, false, false});
+        }
+        else if (blocks.empty())
+        {
+            std::cerr << "Warning: #" << name << " without #if ignored" << std::endl;
+            continue;
+        }
+
+        Block &block = blocks.back();
+        if (opening || name == "elif")
+        {
+            block.live = false;
+            if (block.parentLive && !block.taken)
+            {
+                ConditionValue value = evaluateDirective(name, argument, defines);
+                block.taken = value.known && value.value != 0;
+                block.live = !value.known || value.value != 0;
+                if (keepUnknown && !value.known)
+                {
+                    result += (block.emitted ? "#elif " : "#if ") + value.residual + "\n";
+                    block.emitted = true;
+                }
+                else if (block.taken && block.emitted)
+                {
+                    result += "#else\n"; // the remaining branches can no longer be reached
+                }
+            }
+        }
+        else if (name == "else")
+        {
+            block.live = block.parentLive && !block.taken;
+            block.taken = true;
+            if (block.live && block.emitted) result += "#else\n";
+        }
+        else
+        {
+            if (block.emitted) result += "#endif\n";
+            blocks.pop_back();
+        }
+    }
+    if (!blocks.empty())
+    {
+        std::cerr << "Warning: Unterminated #if at end of bundle" << std::endl;
+    }
+    return result;
+}
+
+// One --axis: the values a define takes across the generated variants; nullopt leaves it undefined.
+struct DefineAxis
+{
+    std::string name;
+    std::vector<std::optional<std::string>> values;
+};
+
+using DefineAssignment = std::vector<std::pair<std::string, std::optional<std::string>>>;
+
+// "out.wgsl" with A=2, B defined without a value and C undefined becomes "out.A=2.B.wgsl".
+std::string variantFileName(const std::string &outputFile, const DefineAssignment &assignment)
+{
+    std::filesystem::path outputPath(outputFile);
+    std::string name = outputPath.stem().string();
+    for (const auto &[define, value] : assignment)
+    {
+        if (value) name += "." + define + (value->empty() ? std::string() : "=" + *value);
+    }
+    name += outputPath.extension().string();
+    return (outputPath.parent_path() / name).string();
+}
+
+/**
+ * @brief Writes the variants for every combination of the axes not yet in the assignment.
+ *
+ * The bundle is analysed with those axes unknown. Only an axis that a reachable condition
+ * depends on, given the assignment so far, gets split into its values. So with
+ * "#ifdef SHADOWS / #if QUALITY > 1", QUALITY multiplies only the SHADOWS variants.
+ */
+bool writeVariantsFrom(const std::string &bundle, const std::string &outputFile, const DefineSet &defines,
+                       const std::vector<DefineAxis> &axes, DefineAssignment &assignment, std::string &manifest)
+{
+    DefineSet analysis = defines;
+    std::set<std::string> references;
+    analysis.references = &references;
+    for (const auto &axis : axes)
+    {
+        analysis.unknown.insert(axis.name);
+    }
+    applyConditionals(bundle, analysis);
+
+    auto next = std::find_if(axes.begin(), axes.end(), [&](const DefineAxis &axis) { return references.count(axis.name) > 0; });
+    if (next == axes.end())
+    {
+        // Nothing left that any reachable condition depends on: one file for all remaining values
+        std::string variantFile = variantFileName(outputFile, assignment);
+        if (!writeWholeFile(variantFile, applyConditionals(bundle, defines)))
+        {
+            std::cerr << "Error: Could not write output file: " << variantFile << std::endl;
+            return false;
+        }
+        std::string defineList;
+        for (const auto &[define, value] : assignment)
+        {
+            defineList += (defineList.empty() ? "" : " ") + (value ? define + "=" + (value->empty() ? "1" : *value) : "!" + define);
+        }
+        manifest += defineList + "\t" + variantFile + "\n";
+        return true;
+    }
+
+    std::vector<DefineAxis> remaining;
+    std::copy_if(axes.begin(), axes.end(), std::back_inserter(remaining), [&](const DefineAxis &axis) { return &axis != &*next; });
+    for (const auto &value : next->values)
+    {
+        DefineSet branch = defines;
+        if (value) branch.values[next->name] = value->empty() ? "1" : *value;
+        else branch.values.erase(next->name);
+        assignment.emplace_back(next->name, value);
+        bool written = writeVariantsFrom(bundle, outputFile, branch, remaining, assignment, manifest);
+        assignment.pop_back();
+        if (!written) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes one output per combination of axis values that can change the bundle.
+ *
+ * Combinations that differ only in defines no reachable condition depends on share one file.
+ * <output>.variants maps the defines of each file to it; axes not named on a line do not matter
+ * for that file.
+ *
+ * @return False if an output could not be written.
+ */
+bool writeVariants(const std::string &bundle, const std::string &outputFile, const DefineSet &fixed, const std::vector<DefineAxis> &axes)
+{
+    DefineAssignment assignment;
+    std::string manifest;
+    return writeVariantsFrom(bundle, outputFile, fixed, axes, assignment, manifest) &&
+           writeFileAtomically(outputFile + ".variants", manifest);
+}
+
+// ---------------------------------------------------------------------------
+// Remote cache
+//
+// --remote-cache <host>:<port> shares bundles between machines over a plain TCP protocol.
+// Keys are 32 hex digits. A bundle is stored under the fingerprint of its inputs' manifest
+// (see fingerprintInputs()), and the manifest under a key known before resolving the entry
+// (see remoteEntryKey()), so a hit needs no include resolution.
+// Request:  "GET <key>\n", or "PUT <key> <size>\n" followed by the object
+// Response: "HIT <size>\n" followed by the object, "MISS\n", "OK\n" or "ERROR <message>\n"
+// Objects are "<16 hex digits>\n" and the payload, the digits being hashBytes() of the
+// payload; clients check them, servers store objects as they come. Several requests may share
+// a connection. --cache-server [<address>:]<port> is a reference server keeping objects
+// under <cache dir>/remote.
+// ---------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+// Set from SIGINT/SIGTERM by --serve and --cache-server. Blocking reads give up on it.
+std::atomic<bool> daemonStopRequested{false};
+
+// Bounds every blocking read and write on a socket, so a stalled peer cannot hold up whoever
+// serves it for longer than that.
+void setSocketTimeouts(int descriptor, time_t seconds)
+{
+    timeval timeout{seconds, 0};
+    setsockopt(descriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(descriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+// Waits until the descriptor is readable; false once a stop was requested or the deadline passed.
+bool waitReadable(int descriptor, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+{
+    pollfd pollDescriptor{descriptor, POLLIN, 0};
+    while (!daemonStopRequested.load() && std::chrono::steady_clock::now() < deadline)
+    {
+        if (poll(&pollDescriptor, 1, 200) > 0) return true;
+    }
+    return false;
+}
+
+bool writeAll(int descriptor, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(descriptor, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Reads up to and excluding the first '\n'. With a deadline, gives up when it passes or a stop
+// is requested, instead of blocking on a client that never sends the rest.
+bool readLine(int descriptor, std::string &line,
+              std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+{
+    bool bounded = deadline != std::chrono::steady_clock::time_point::max();
+    line.clear();
+    char c;
+    while (true)
+    {
+        if (bounded && !waitReadable(descriptor, deadline)) return false;
+        ssize_t received = read(descriptor, &c, 1);
+        if (received < 0 && errno == EINTR && !daemonStopRequested.load()) continue;
+        if (received <= 0) return false;
+        if (c == '\n') return true;
+        line += c;
+    }
+}
+
+bool readExactly(int descriptor, size_t size, std::string &data)
+{
+    data.resize(size);
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t received = read(descriptor, data.data() + done, size - done);
+        if (received < 0 && errno == EINTR && !daemonStopRequested.load()) continue;
+        if (received <= 0) return false;
+        done += static_cast<size_t>(received);
+    }
+    return true;
+}
+
+#endif // _WIN32
+
+// Remote objects are bundles; anything larger is refused rather than buffered.
+constexpr uint64_t maxRemoteObjectSize = 1ull << 30;
+
+bool isRemoteCacheKey(std::string_view key)
+{
+    return key.size() == 32 && key.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+}
+
+/**
+ * @brief Client side of --remote-cache. One connection, kept open and shared under a lock.
+ *
+ * Any failure to reach the server or a malformed reply disables the client for the rest of
+ * the run after one warning, so an unreachable cache costs one timeout, not one per entry.
+ */
+class RemoteCache
+{
+public:
+    RemoteCache() = default;
+    RemoteCache(const RemoteCache &) = delete;
+    RemoteCache &operator=(const RemoteCache &) = delete;
+
+    ~RemoteCache()
+    {
+#ifndef _WIN32
+        if (connection >= 0) close(connection);
+#endif
+    }
+
+    // "<host>:<port>"; the connection is opened on first use.
+    void configure(const std::string &address) { serverAddress = address; }
+
+    bool enabled() const { return !serverAddress.empty() && !failed; }
+
+    // False on a miss, and for an object whose content hash does not match: a damaged object
+    // is as good as none.
+    bool get(const std::string &key, std::string &payload)
+    {
+#ifdef _WIN32
+        (void)key;
+        (void)payload;
+        return disable();
+#else
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string request = "GET " + key + "\n";
+        std::string status;
+        std::string object;
+        if (!connect() || !writeAll(connection, request.data(), request.size()) || !readLine(connection, status))
+        {
+            return disable();
+        }
+        if (status == "MISS") return false;
+        uint64_t size = 0;
+        if (status.rfind("HIT ", 0) != 0 || std::from_chars(status.data() + 4, status.data() + status.size(), size).ec != std::errc() ||
+            size > maxRemoteObjectSize || !readExactly(connection, static_cast<size_t>(size), object))
+        {
+            return disable();
+        }
+        uint64_t contentHash = 0;
+        if (object.size() < 17 || object[16] != '\n' ||
+            std::from_chars(object.data(), object.data() + 16, contentHash, 16).ec != std::errc() ||
+            hashBytes(std::string_view(object).substr(17)) != contentHash)
+        {
+            std::cerr << "Warning: Remote cache object " << key << " is damaged, ignoring it" << std::endl;
+            return false;
+        }
+        payload = object.substr(17);
+        return true;
+#endif
+    }
+
+    void put(const std::string &key, std::string_view payload)
+    {
+#ifdef _WIN32
+        (void)key;
+        (void)payload;
+        disable();
+#else
+        std::lock_guard<std::mutex> lock(mutex);
+        char header[18];
+        std::snprintf(header, sizeof(header), "%016llx\n", static_cast<unsigned long long>(hashBytes(payload)));
+        size_t size = 17 + payload.size();
+        std::string request = "PUT " + key + " " + std::to_string(size) + "\n" + header;
+        std::string status;
+        if (size > maxRemoteObjectSize) return;
+        if (!connect() || !writeAll(connection, request.data(), request.size()) ||
+            !writeAll(connection, payload.data(), payload.size()) || !readLine(connection, status) || status != "OK")
+        {
+            disable();
+        }
+#endif
+    }
+
+private:
+#ifndef _WIN32
+    bool connect()
+    {
+        if (connection >= 0) return true;
+        size_t colon = serverAddress.rfind(':');
+        if (colon == std::string::npos) return false;
+        std::string host = serverAddress.substr(0, colon);
+        std::string port = serverAddress.substr(colon + 1);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) return false;
+        for (addrinfo *address = addresses; address != nullptr && connection < 0; address = address->ai_next)
+        {
+            int descriptor = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (descriptor < 0) continue;
+            setSocketTimeouts(descriptor, 5); // also bounds connect()
+            if (::connect(descriptor, address->ai_addr, address->ai_addrlen) == 0)
+            {
+                connection = descriptor;
+            }
+            else
+            {
+                close(descriptor);
+            }
+        }
+        freeaddrinfo(addresses);
+        signal(SIGPIPE, SIG_IGN); // a server going away mid-request is an error return, not a signal
+        return connection >= 0;
+    }
+#endif
+
+    bool disable()
+    {
+        if (!failed)
+        {
+            std::cerr << "Warning: Remote cache " << serverAddress << " unavailable, building locally" << std::endl;
+        }
+        failed = true;
+#ifndef _WIN32
+        if (connection >= 0) close(connection);
+#endif
+        connection = -1;
+        return false;
+    }
+
+    std::string serverAddress;
+    int connection = -1;
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+};
+
+// ---------------------------------------------------------------------------
+// Entry jobs
+//
+// One entry's way through the tool, split into the stages the batch pipeline overlaps:
+// prepare (plans, replay, reading ahead) -> resolve -> assemble -> write.
+// A single-entry run performs the same stages back to back.
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Writes outputs so that byte-identical bundles of one run share storage.
+ *
+ * The first output with some content is written normally. Later outputs with the same content
+ * become a reflink (FICLONE) of it where the filesystem supports that, else a hardlink, else a
+ * plain copy. Each output is put in place with a rename, and writeWholeFile() never writes
+ * through a shared link, so rewriting one output later leaves its twins alone.
+ * Called from the write stage only.
+ */
+class OutputDeduplicator
+{
+public:
+    bool write(const std::string &outputFile, const std::string &bundle)
+    {
+        uint64_t hash = hashBytes(bundle);
+        std::vector<std::filesystem::path> &twins = written[hash];
+        for (const auto &twin : twins)
+        {
+            if (holds(twin, bundle) && materialize(twin, outputFile))
+            {
+                return true;
+            }
+        }
+        if (!writeFileAtomically(outputFile, bundle))
+        {
+            return false;
+        }
+        twins.push_back(outputFile);
+        return true;
+    }
+
+    uint64_t reflinked = 0;
+    uint64_t hardlinked = 0;
+
+private:
+    // The hash only nominates candidates; the twin must still hold exactly these bytes.
+    static bool holds(const std::filesystem::path &twin, const std::string &bundle)
+    {
+        MappedFile existing;
+        return existing.open(twin) && existing.size() == bundle.size() &&
+               std::memcmp(existing.data(), bundle.data(), bundle.size()) == 0;
+    }
+
+    bool materialize(const std::filesystem::path &twin, const std::string &outputFile)
+    {
+#ifdef _WIN32
+        (void)twin;
+        (void)outputFile;
+        return false;
+#else
+        FileIdentity twinIdentity;
+        FileIdentity outputIdentity;
+        if (readFileIdentity(twin, twinIdentity) && readFileIdentity(outputFile, outputIdentity) &&
+            twinIdentity.device == outputIdentity.device && twinIdentity.inode == outputIdentity.inode)
+        {
+            return true; // already linked by an earlier run
+        }
+
+        std::string temporaryPath = outputFile + ".tmp";
+        ::unlink(temporaryPath.c_str());
+#ifdef FICLONE
+        int source = ::open(twin.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source >= 0)
+        {
+            int target = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            bool cloned = target >= 0 && ioctl(target, FICLONE, source) == 0;
+            if (target >= 0) close(target);
+            close(source);
+            if (cloned && ::rename(temporaryPath.c_str(), outputFile.c_str()) == 0)
+            {
+                reflinked++;
+                return true;
+            }
+            ::unlink(temporaryPath.c_str());
+        }
+#endif
+        if (::link(twin.c_str(), temporaryPath.c_str()) == 0)
+        {
+            if (::rename(temporaryPath.c_str(), outputFile.c_str()) == 0)
+            {
+                hardlinked++;
+                return true;
+            }
+            ::unlink(temporaryPath.c_str());
+        }
+        return false; // e.g. another filesystem: the caller writes a copy
+#endif
+    }
+
+    std::map<uint64_t, std::vector<std::filesystem::path>> written;
+};
+
+// State shared by all jobs of one run.
+struct JobContext
+{
+    SourceCache sources;
+    bool emissionPlans = true;
+    bool alwaysAssemble = false; // the caller needs the bundle even if the output is up to date
+    bool needsIncludes = false;  // the caller needs the resolved include list, so nothing is fetched
+    bool deduplicateOutputs = false;
+    OutputDeduplicator outputs;
+    bool semanticKeys = false;
+    bool conditionals = false;   // resolve #if blocks against defines before writing
+    DefineSet defines;
+    CacheDirectory cache;
+    EmbedCache embeds;
+    RemoteCache remote;
+    std::filesystem::path projectRoot;     // --project-root, canonical; empty for absolute paths everywhere
+    std::string generators;                // "--generator name=command" lines
+    std::string prefixSnapshotFile;
+
+    // Every option emissionKey() covers besides the entry and the prefix.
+    std::string keyOptions() const { return (conditionals ? defines.describe() : std::string()) + generators; }
+
+    // Loaded on first use, from the resolve stage only.
+    PrefixSnapshot *prefix()
+    {
+        if (!prefixLoaded)
+        {
+            prefixLoaded = true;
+            prefixUsable = !prefixSnapshotFile.empty() && loadPrefixSnapshot(prefixSnapshotFile, prefixSnapshot);
+        }
+        return prefixUsable ? &prefixSnapshot : nullptr;
+    }
+
+private:
+    PrefixSnapshot prefixSnapshot;
+    bool prefixLoaded = false;
+    bool prefixUsable = false;
+};
+
+struct EntryJob
+{
+    std::string inputFile;                // as given on the command line or in the batch list
+    std::string outputFile;               // empty for stdout
+    std::filesystem::path entryPath;      // canonical
+    bool usePlan = false;
+    std::filesystem::path planPath;
+    std::string planKey;
+    EmissionPlan previousPlan;
+    bool planLoaded = false;
+    bool upToDate = false;                // nothing to do: inputs and output match the plan
+    bool replayed = false;                // bundle rebuilt from the plan, no resolving needed
+    bool fetched = false;                 // bundle downloaded from the remote cache, conditionals applied
+    std::string remoteKey;                // remoteEntryKey(), where the entry's manifest is shared
+    std::string journalKey;               // with --journal: emissionKey() of the entry
+    bool resumed = false;                 // completed by an earlier run, according to the journal
+    std::thread prefetch;
+    EntryResult result;
+};
+
+/**
+ * @brief Resolves an input argument the way the command line always has: relative to the
+ * directory of the executable, then canonicalized. Paths into an --archive are accepted too.
+ *
+ * @return True if the file exists.
+ */
+bool resolveInputPath(const std::filesystem::path &programBaseDir, const std::string &inputFile, const SourceCache &sources,
+                      std::filesystem::path &entryPath)
+{
+    // Normalize the absolute initial file path to remove redundant '.' or '..'
+    try
+    {
+        entryPath = std::filesystem::canonical(programBaseDir / inputFile);
+        return true;
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        // Not on disk, but perhaps a member of an --archive
+        std::error_code error;
+        std::filesystem::path provided = std::filesystem::weakly_canonical(programBaseDir / inputFile, error);
+        if (!error && sources.providerFor(provided) != nullptr)
+        {
+            entryPath = provided;
+            return true;
+        }
+        std::cerr << "Error resolving canonical path for initial input file: " << inputFile << std::endl;
+        std::cerr << "Filesystem error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+/**
+ * @brief Decides how much work a job needs, using the plan stored next to its output.
+ *
+ * @param job The job; entryPath and outputFile must be set.
+ * @param context The run's shared state.
+ * @param preload True to read the previous plan's files into the source cache now (the batch
+ * pipeline's load stage); false to only hint them to the kernel from a background thread.
+ */
+void prepareEntryJob(EntryJob &job, JobContext &context, bool preload)
+{
+    job.usePlan = context.emissionPlans && !job.outputFile.empty();
+    if (!job.usePlan)
+    {
+        return;
+    }
+    job.planPath = job.outputFile + ".plan";
+    job.planKey = emissionKey(job.entryPath, context.prefixSnapshotFile, context.keyOptions(), context.projectRoot);
+    job.planLoaded = loadEmissionPlan(job.planPath, std::string(), job.previousPlan, context.projectRoot);
+    if (job.planLoaded && job.previousPlan.key == job.planKey)
+    {
+        // Nothing to do at all if neither the inputs nor the output changed since the last run
+        std::vector<std::filesystem::path> files = job.previousPlan.files;
+        std::vector<FileIdentity> identities = job.previousPlan.identities;
+        files.push_back(job.outputFile);
+        identities.push_back(job.previousPlan.outputIdentity);
+        std::vector<bool> unchanged = validateFileIdentities(files, identities);
+        bool keyMissing = context.semanticKeys && job.previousPlan.semanticHash == 0;
+        job.upToDate = !context.alwaysAssemble && !keyMissing && std::find(unchanged.begin(), unchanged.end(), false) == unchanged.end();
+        job.replayed = !job.upToDate && replayEmissionPlan(job.previousPlan, job.result.bundle, context.sources);
+    }
+    if (job.planLoaded && !job.upToDate && !job.replayed)
+    {
+        if (preload)
+        {
+            for (const auto &filePath : job.previousPlan.files)
+            {
+                context.sources.load(filePath);
+            }
+        }
+        else
+        {
+            job.prefetch = prefetchFiles(job.previousPlan.files);
+        }
+    }
+}
+
+bool fetchEntry(EntryJob &job, JobContext &context);
+
+void resolveEntryJob(EntryJob &job, JobContext &context)
+{
+    if (job.upToDate || job.replayed)
+    {
+        return;
+    }
+    if (context.remote.enabled() && !context.needsIncludes && fetchEntry(job, context))
+    {
+        if (job.prefetch.joinable()) job.prefetch.join();
+        return;
+    }
+    resolveEntry(job.entryPath, context.sources, context.prefix(), job.result);
+    if (!job.result.ok)
+    {
+        std::cerr << "findIncludes failed." << std::endl;
+    }
+    if (job.prefetch.joinable())
+    {
+        job.prefetch.join();
+    }
+}
+
+// The start of every remote manifest: what the shared bundles depend on besides their inputs.
+std::string remoteManifestHeader(JobContext &context)
+{
+    std::string header = "wgsl remote v3\n";
+    if (context.conditionals) header += context.defines.describe(); // shared bundles have them applied
+    if (PrefixSnapshot *prefix = context.prefix())
+    {
+        char hash[32];
+        std::snprintf(hash, sizeof(hash), "prefix %016llx\n", static_cast<unsigned long long>(hashBytes(prefix->bundle)));
+        header += hash;
+    }
+    return header;
+}
+
+// 32 hex digits fingerprinting a text, as remote cache keys are spelled.
+std::string remoteKeyOf(std::string_view text)
+{
+    char key[40];
+    std::snprintf(key, sizeof(key), "%016llx%016llx", static_cast<unsigned long long>(hashBytes(text)),
+                  static_cast<unsigned long long>(hashBytes(text, 0x9e3779b97f4a7c15ULL)));
+    return key;
+}
+
+/**
+ * @brief Computes the key an entry's manifest is shared under, from nothing but the entry file
+ * itself: its place in the project and its contents.
+ *
+ * @return False if the entry cannot be read.
+ */
+bool remoteEntryKey(EntryJob &job, JobContext &context, std::string &key)
+{
+    std::shared_ptr<const SourceFile> entry = context.sources.load(job.entryPath);
+    if (!entry) return false;
+    char hash[20];
+    std::snprintf(hash, sizeof(hash), "\t%016llx\n", static_cast<unsigned long long>(hashBytes(entry->text)));
+    key = remoteKeyOf(remoteManifestHeader(context) + "entry " + projectRelative(job.entryPath, context.projectRoot) + hash);
+    return true;
+}
+
+/**
+ * @brief Lists every file the bundle of a resolved entry is made from (includes, #embed data,
+ * the prefix snapshot's bundle) with the hash of its contents. The bundle is shared under the
+ * remoteKeyOf() this manifest.
+ *
+ * @param inputs Receives the files covered, in emission order, with their identities and
+ * content hashes.
+ * @return False if some input could not be read; such entries are never shared.
+ */
+bool fingerprintInputs(EntryJob &job, JobContext &context, EmissionPlan &inputs, std::string &manifest)
+{
+    manifest = remoteManifestHeader(context);
+    auto addInput = [&](const std::filesystem::path &filePath, const FileIdentity &identity, std::string_view text) {
+        uint64_t contentHash = hashBytes(text);
+        char hash[20];
+        std::snprintf(hash, sizeof(hash), "\t%016llx\n", static_cast<unsigned long long>(contentHash));
+        manifest += projectRelative(filePath, context.projectRoot);
+        manifest += hash;
+        inputs.addFile(filePath, identity, contentHash);
+    };
+
+    inputs = EmissionPlan();
+    if (job.result.prefixReached)
+    {
+        PrefixSnapshot *prefix = context.prefix();
+        addInput(prefix->snapshotPath, prefix->snapshotIdentity, prefix->bundle);
+        for (const auto &[prefixFile, identity] : prefix->files)
+        {
+            inputs.addFile(prefixFile, identity); // covered by the snapshot's bundle
+        }
+    }
+    for (const auto &filePath : job.result.files)
+    {
+        std::shared_ptr<const SourceFile> source = context.sources.load(filePath);
+        if (!source) return false;
+        addInput(filePath, source->identity, source->text);
+
+        // #embed data, located the way assembleBundle() does
+        size_t position = 0;
+        while ((position = source->text.find("#embed", position)) != std::string::npos)
+        {
+            bool lineStart = position == 0 || source->text[position - 1] == '\n';
+            size_t lineEnd = source->text.find('\n', position);
+            std::string_view line(source->text.data() + position, (lineEnd == std::string::npos ? source->text.size() : lineEnd) - position);
+            position += 6;
+            if (!lineStart || !(line.starts_with("#embed ") || line.starts_with("#embed\t"))) continue;
+            std::string fileName;
+            std::istringstream words{std::string(line.substr(6))};
+            words >> std::quoted(fileName);
+            std::filesystem::path dataPath;
+            std::string data;
+            FileIdentity identity;
+            if (!EmbedCache::resolveDataPath(filePath, fileName, context.sources, dataPath) ||
+                !context.sources.read(dataPath, data, identity))
+            {
+                return false;
+            }
+            addInput(dataPath, identity, data);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks a manifest fetched for this entry against the files here.
+ *
+ * Includes resolve from the including file's place and text alone, so if every listed file
+ * still has the listed contents, resolving the entry would find exactly these files again.
+ *
+ * @param inputs Receives the files listed, as fingerprintInputs() would have.
+ * @return True if the manifest was made with the same options and all its files match.
+ */
+bool verifyManifest(JobContext &context, std::string_view manifest, EmissionPlan &inputs)
+{
+    std::string header = remoteManifestHeader(context);
+    if (!manifest.starts_with(header)) return false;
+    PrefixSnapshot *prefix = context.prefix();
+    inputs = EmissionPlan();
+    for (size_t lineStart = header.size(); lineStart < manifest.size();)
+    {
+        size_t lineEnd = manifest.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) return false;
+        std::string_view line = manifest.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        size_t tab = line.rfind('\t');
+        uint64_t expected = 0;
+        if (tab == std::string_view::npos ||
+            std::from_chars(line.data() + tab + 1, line.data() + line.size(), expected, 16).ec != std::errc())
+        {
+            return false;
+        }
+        std::string_view name = line.substr(0, tab);
+        std::filesystem::path filePath = isGeneratedPath(name) ? std::filesystem::path(name) : context.projectRoot / std::filesystem::path(name);
+        if (prefix != nullptr && filePath == prefix->snapshotPath)
+        {
+            inputs.addFile(prefix->snapshotPath, prefix->snapshotIdentity, expected); // checked by the header
+            for (const auto &[prefixFile, identity] : prefix->files)
+            {
+                inputs.addFile(prefixFile, identity);
+            }
+            continue;
+        }
+        std::string text;
+        FileIdentity identity;
+        if (!context.sources.read(filePath, text, identity) || hashBytes(text) != expected) return false;
+        inputs.addFile(filePath, identity, expected);
+    }
+    return true;
+}
+
+/**
+ * @brief Looks for a bundle of this entry in the remote cache before resolving it: the
+ * manifest shared under remoteEntryKey() names the inputs, and if they all match here, the
+ * bundle shared under the manifest's fingerprint is the one this entry would produce.
+ *
+ * @return True if the bundle was fetched; it has the conditionals applied already.
+ */
+bool fetchEntry(EntryJob &job, JobContext &context)
+{
+    std::string manifest;
+    EmissionPlan inputs;
+    if (!remoteEntryKey(job, context, job.remoteKey) || !context.remote.get(job.remoteKey, manifest) ||
+        !verifyManifest(context, manifest, inputs) || !context.remote.get(remoteKeyOf(manifest), job.result.bundle))
+    {
+        return false;
+    }
+    // Replayable like any other bundle: the inputs as listed, the bytes as one literal
+    job.fetched = true;
+    job.result.ok = true;
+    job.result.plan = std::move(inputs);
+    job.result.plan.addLiteral(job.result.bundle);
+    job.result.plan.evaluated = true;
+    return true;
+}
+
+void assembleEntryJob(EntryJob &job, JobContext &context)
+{
+    if (job.upToDate || job.fetched)
+    {
+        return;
+    }
+    if (!job.replayed)
+    {
+        assembleEntry(context.sources, context.prefix(), job.result, &context.embeds);
+    }
+    if (context.conditionals && !(job.replayed && job.previousPlan.evaluated))
+    {
+        // Plans describe the bundle before conditions are applied, except those of fetched
+        // bundles, so replays go through here too
+        job.result.bundle = applyConditionals(job.result.bundle, context.defines, context.defines.othersUnknown);
+    }
+    if (!job.replayed && job.result.ok && context.remote.enabled() && !job.remoteKey.empty())
+    {
+        // The bundle first, so whoever finds the manifest also finds the bundle
+        std::string manifest;
+        EmissionPlan inputs;
+        if (fingerprintInputs(job, context, inputs, manifest))
+        {
+            context.remote.put(remoteKeyOf(manifest), job.result.bundle);
+            context.remote.put(job.remoteKey, manifest);
+        }
+    }
+}
+
+// Writes the fingerprint as 16 hex digits, leaving the file untouched if it already holds them.
+bool writeSemanticKey(const std::string &keyPath, uint64_t fingerprint)
+{
+    char text[18];
+    std::snprintf(text, sizeof(text), "%016llx\n", static_cast<unsigned long long>(fingerprint));
+    std::string existing;
+    FileIdentity identity;
+    if (readWholeFile(keyPath, existing, identity) && existing == text)
+    {
+        return true;
+    }
+    return writeFileAtomically(keyPath, text);
+}
+
+// What a processed job's bundle was built from.
+const EmissionPlan &jobPlan(const EntryJob &job)
+{
+    return job.upToDate || job.replayed ? job.previousPlan : job.result.plan;
+}
+
+/**
+ * @brief Writes a Makefile-style depfile ("<target>: <input> ..."), as read by make and
+ * ninja, leaving it untouched if it already says the same. Inputs served by a provider are
+ * listed as the files behind them (the archive, the compressed file, the git refs), generated
+ * ones not at all. Inputs are listed as absolute paths: make and ninja resolve relative ones
+ * against their own working directory, which need not be the --project-root.
+ */
+bool writeDepfile(const std::string &depfilePath, const std::string &target, const std::vector<std::filesystem::path> &inputs,
+                  SourceCache &sources)
+{
+    auto escape = [](const std::string &path) {
+        std::string escaped;
+        for (size_t i = 0; i < path.size(); i++)
+        {
+            char c = path[i];
+            bool drive = c == ':' && i == 1 && std::isalpha(static_cast<unsigned char>(path[0]));
+            if (c == ' ' || c == '#' || c == '\\' || (c == ':' && !drive)) escaped += '\\';
+            if (c == '$') escaped += '$';
+            escaped += c;
+        }
+        return escaped;
+    };
+    std::string text = escape(target) + ":";
+    std::set<std::filesystem::path> listed;
+    for (const auto &input : inputs)
+    {
+        SourceProvider *provider = sources.providerFor(input);
+        for (const auto &file : provider != nullptr ? provider->backingFiles(input) : std::vector<std::filesystem::path>{input})
+        {
+            if (listed.insert(file).second) text += " \\\n  " + escape(std::filesystem::absolute(file).string());
+        }
+    }
+    text += "\n";
+    std::string existing;
+    FileIdentity identity;
+    if (readWholeFile(depfilePath, existing, identity) && existing == text)
+    {
+        return true;
+    }
+    return writeFileAtomically(depfilePath, text);
+}
+
+/**
+ * @brief Writes a job's output and refreshes its plan.
+ *
+ * @return False if the output could not be written.
+ */
+bool writeEntryJob(EntryJob &job, JobContext &context)
+{
+    if (job.upToDate)
+    {
+        return true;
+    }
+    const std::string &bundle = job.result.bundle;
+
+    // With --semantic-key an output that only differs in comments or whitespace is left alone,
+    // so whatever caches on it (mtime or content) does not rebuild for a cosmetic edit.
+    uint64_t fingerprint = 0;
+    bool keepOutput = false;
+    if (context.semanticKeys && job.usePlan)
+    {
+        fingerprint = semanticFingerprint(bundle);
+        FileIdentity currentOutput;
+        keepOutput = job.planLoaded && job.previousPlan.semanticHash == fingerprint &&
+                     readFileIdentity(job.outputFile, currentOutput) && currentOutput == job.previousPlan.outputIdentity;
+    }
+    FileIdentity keptIdentity = job.previousPlan.outputIdentity;
+    uint64_t keptHash = job.previousPlan.outputHash;
+
+    bool written = keepOutput ||
+                   (context.deduplicateOutputs && !job.outputFile.empty() ? context.outputs.write(job.outputFile, bundle)
+                                                                           : writeWholeFile(job.outputFile, bundle));
+    if (!written)
+    {
+        std::cerr << "Error: Could not write output file: " << (job.outputFile.empty() ? "<stdout>" : job.outputFile) << std::endl;
+        return false;
+    }
+    if (job.usePlan && (job.replayed || job.result.ok))
+    {
+        EmissionPlan &plan = job.replayed ? job.previousPlan : job.result.plan;
+        if (keepOutput)
+        {
+            plan.outputIdentity = keptIdentity;
+            plan.outputHash = keptHash; // describes the bytes actually on disk
+        }
+        else
+        {
+            readFileIdentity(job.outputFile, plan.outputIdentity);
+            plan.outputHash = hashBytes(bundle);
+        }
+        plan.semanticHash = fingerprint;
+        if (!writeEmissionPlan(job.planPath, job.planKey, plan, context.projectRoot))
+        {
+            std::cerr << "Warning: Could not write emission plan: " << job.planPath << std::endl;
+        }
+    }
+    if (context.semanticKeys && job.usePlan && !writeSemanticKey(job.outputFile + ".key", fingerprint))
+    {
+        std::cerr << "Warning: Could not write cache key: " << job.outputFile << ".key" << std::endl;
+    }
+    return true;
+}
+
+// A fixed-capacity FIFO between two pipeline stages; push blocks while full, pop while empty.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+};
+
+/**
+ * @brief Reads a batch list: one "<input_file>\t<output_file>" (or space separated) per line.
+ */
+bool readBatchList(const std::string &listFile, std::vector<std::unique_ptr<EntryJob>> &jobs)
+{
+    std::ifstream list(listFile);
+    if (!list.is_open())
+    {
+        std::cerr << "Error: Could not open batch list: " << listFile << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        size_t separator = line.find('\t');
+        if (separator == std::string::npos) separator = line.find(' ');
+        if (separator == std::string::npos)
+        {
+            std::cerr << "Error: Batch line needs an input and an output file: " << line << std::endl;
+            return false;
+        }
+        auto job = std::make_unique<EntryJob>();
+        job->inputFile = line.substr(0, separator);
+        job->outputFile = line.substr(line.find_first_not_of(" \t", separator));
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+/**
+ * @brief Checkpoints of a --batch run, so an interrupted run resumes where it stopped.
+ *
+ * Each written output appends one record: its plan key, output identity and the identity of
+ * every input it was built from. Records are buffered and written with one fdatasync per 64
+ * (or per second), so a crash loses at most the last few entries. Every record carries its
+ * own hash and length, and reading stops at the first torn or corrupt one; the journal is then
+ * cut back to the last good record, so what the next run appends can be read again. On the
+ * next run an entry whose record still matches the disk is skipped before it is even resolved.
+ * This also works under --no-plan, where no plan files are kept.
+ */
+class BatchJournal
+{
+public:
+    BatchJournal() = default;
+    BatchJournal(const BatchJournal &) = delete;
+    BatchJournal &operator=(const BatchJournal &) = delete;
+
+    ~BatchJournal()
+    {
+        flush();
+#ifndef _WIN32
+        if (descriptor >= 0) close(descriptor);
+#endif
+    }
+
+    // Reads the records of earlier runs and opens the journal for appending.
+    bool open(const std::filesystem::path &path, const std::filesystem::path &root)
+    {
+        journalPath = path;
+        projectRoot = root;
+        size_t recordCount = 0;
+        size_t validSize = 0;
+        size_t fileSize = 0;
+        {
+            MappedFile existing;
+            if (existing.open(journalPath))
+            {
+                fileSize = existing.size();
+                BinaryReader reader(existing.data(), existing.size());
+                uint64_t hash;
+                std::string_view payload;
+                while (reader.read(hash) && reader.readString(payload) && hashBytes(payload) == hash)
+                {
+                    Record record;
+                    if (!parse(payload, record)) break;
+                    records[record.output] = std::move(record);
+                    recordCount++;
+                    validSize = reader.position();
+                }
+            }
+        }
+        if (recordCount > records.size() * 2 + 64)
+        {
+            // Mostly superseded records: keep the latest per output
+            std::string compacted;
+            for (const auto &entry : records) compacted += frame(serialize(entry.second));
+            writeFileAtomically(journalPath, compacted);
+        }
+        else if (validSize < fileSize)
+        {
+            // A torn tail from an interrupted run; records appended after it would never be read
+            std::error_code error;
+            std::filesystem::resize_file(journalPath, validSize, error);
+            if (error)
+            {
+                std::cerr << "Error: Could not truncate journal: " << journalPath << std::endl;
+                return false;
+            }
+        }
+#ifdef _WIN32
+        return true;
+#else
+        descriptor = ::open(journalPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (descriptor < 0) std::cerr << "Error: Could not open journal: " << journalPath << std::endl;
+        return descriptor >= 0;
+#endif
+    }
+
+    // True if the output was completed by an earlier run and nothing it depends on changed since.
+    bool completed(const std::string &outputFile, const std::string &key) const
+    {
+        auto found = records.find(outputFile);
+        if (found == records.end() || found->second.key != key) return false;
+        const Record &record = found->second;
+        std::vector<std::filesystem::path> files = record.files;
+        std::vector<FileIdentity> identities = record.identities;
+        files.push_back(outputFile);
+        identities.push_back(record.outputIdentity);
+        std::vector<bool> unchanged = validateFileIdentities(files, identities);
+        return std::find(unchanged.begin(), unchanged.end(), false) == unchanged.end();
+    }
+
+    // Called from the write stage once the output is on disk.
+    void record(const std::string &outputFile, const std::string &key, const EmissionPlan &plan)
+    {
+        Record record;
+        record.output = outputFile;
+        record.key = key;
+        if (!readFileIdentity(outputFile, record.outputIdentity)) return;
+        record.files = plan.files;
+        record.identities = plan.identities;
+        pending += frame(serialize(record));
+        pendingCount++;
+        if (pendingCount >= 64 || std::chrono::steady_clock::now() - lastFlush >= std::chrono::seconds(1))
+        {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (pending.empty()) return;
+#ifdef _WIN32
+        std::ofstream journal(journalPath, std::ios::binary | std::ios::app);
+        journal.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+#else
+        if (descriptor >= 0 && writeAll(descriptor, pending.data(), pending.size()))
+        {
+            fdatasync(descriptor);
+        }
+#endif
+        pending.clear();
+        pendingCount = 0;
+        lastFlush = std::chrono::steady_clock::now();
+    }
+
+private:
+    struct Record
+    {
+        std::string output;
+        std::string key;
+        FileIdentity outputIdentity;
+        std::vector<std::filesystem::path> files;
+        std::vector<FileIdentity> identities;
+    };
+
+    std::string serialize(const Record &record) const
+    {
+        BinaryWriter writer;
+        writer.writeString(record.output);
+        writer.writeString(record.key);
+        writer.write(record.outputIdentity);
+        writer.write<uint64_t>(record.files.size());
+        for (size_t i = 0; i < record.files.size(); i++)
+        {
+            writer.write(record.identities[i]);
+            writer.writeString(projectRelative(record.files[i], projectRoot));
+        }
+        return writer.data;
+    }
+
+    bool parse(std::string_view payload, Record &record) const
+    {
+        BinaryReader reader(payload.data(), payload.size());
+        std::string_view output;
+        std::string_view key;
+        uint64_t fileCount;
+        if (!reader.readString(output) || !reader.readString(key) || !reader.read(record.outputIdentity) || !reader.read(fileCount))
+        {
+            return false;
+        }
+        record.output = output;
+        record.key = key;
+        for (uint64_t i = 0; i < fileCount; i++)
+        {
+            FileIdentity identity;
+            std::string_view filePath;
+            if (!reader.read(identity) || !reader.readString(filePath)) return false;
+            record.identities.push_back(identity);
+            record.files.push_back(isGeneratedPath(filePath) ? std::filesystem::path(filePath) : projectRoot / std::filesystem::path(filePath));
+        }
+        return reader.atEnd();
+    }
+
+    // <u64 hash><length-prefixed payload>
+    static std::string frame(const std::string &payload)
+    {
+        BinaryWriter writer;
+        writer.write(hashBytes(payload));
+        writer.writeString(payload);
+        return writer.data;
+    }
+
+    std::filesystem::path journalPath;
+    std::filesystem::path projectRoot;
+    std::map<std::string, Record> records;
+    std::string pending;
+    size_t pendingCount = 0;
+    std::chrono::steady_clock::time_point lastFlush = std::chrono::steady_clock::now();
+    int descriptor = -1;
+};
+
+/**
+ * @brief Processes many entries, overlapping the stages of consecutive entries.
+ *
+ * Each stage runs on its own thread and hands jobs on through a small bounded queue, so while
+ * one entry's output is being written the next is being assembled, the one after that resolved
+ * and further ones read ahead into the source cache. Jobs leave the pipeline in list order.
+ *
+ * @param journalFile Optional --journal; entries it records as done and unchanged are skipped.
+ * @return 0 if every entry was processed, 1 otherwise.
+ */
+int runBatch(const std::string &listFile, const std::filesystem::path &programBaseDir, JobContext &context, const std::string &journalFile)
+{
+    std::vector<std::unique_ptr<EntryJob>> jobs;
+    if (!readBatchList(listFile, jobs))
+    {
+        return 1;
+    }
+    BatchJournal journal;
+    bool journaling = !journalFile.empty();
+    if (journaling && !journal.open(journalFile, context.projectRoot))
+    {
+        return 1;
+    }
+
+    const size_t queueCapacity = 4;
+    BoundedQueue<EntryJob *> toResolve(queueCapacity);
+    BoundedQueue<EntryJob *> toAssemble(queueCapacity);
+    BoundedQueue<EntryJob *> toWrite(queueCapacity);
+    std::atomic<size_t> failures{0};
+
+    std::thread loader([&] {
+        for (auto &job : jobs)
+        {
+            if (!resolveInputPath(programBaseDir, job->inputFile, context.sources, job->entryPath))
+            {
+                failures++;
+                continue;
+            }
+            if (journaling)
+            {
+                job->journalKey = emissionKey(job->entryPath, context.prefixSnapshotFile, context.keyOptions(), context.projectRoot);
+                job->resumed = journal.completed(job->outputFile, job->journalKey);
+            }
+            if (job->resumed)
+            {
+                job->upToDate = true; // done by an earlier run
+            }
+            else
+            {
+                prepareEntryJob(*job, context, true);
+            }
+            toResolve.push(job.get());
+        }
+        toResolve.close();
+    });
+    std::thread resolver([&] {
+        EntryJob *job;
+        while (toResolve.pop(job))
+        {
+            resolveEntryJob(*job, context);
+            if (!job->upToDate && !job->replayed && !job->result.ok) failures++;
+            toAssemble.push(job);
+        }
+        toAssemble.close();
+    });
+    std::thread assembler([&] {
+        EntryJob *job;
+        while (toAssemble.pop(job))
+        {
+            assembleEntryJob(*job, context);
+            toWrite.push(job);
+        }
+        toWrite.close();
+    });
+
+    EntryJob *job;
+    while (toWrite.pop(job))
+    {
+        if (!writeEntryJob(*job, context))
+        {
+            failures++;
+        }
+        else if (journaling && !job->resumed && (job->upToDate || job->replayed || job->result.ok))
+        {
+            journal.record(job->outputFile, job->journalKey, jobPlan(*job));
+        }
+        job->result = EntryResult(); // release the bundle as soon as it is on disk
+        job->previousPlan = EmissionPlan();
+    }
+    loader.join();
+    resolver.join();
+    assembler.join();
+    return failures == 0 ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Daemon mode
+//
+// --serve <socket> keeps a SourceCache alive across requests on a Unix stream socket.
+// Request:  "<absolute input path>\t<absolute output path or empty>\n"
+// Response: "OK <size>\n" (or "FAILED <size>\n" if an include could not be resolved),
+//           followed by the bundle when no output path was given, or "ERROR <message>\n".
+// --metrics-port <port> serves Prometheus text on 127.0.0.1:<port> from a second thread;
+// the worker only ever touches the metrics through relaxed atomics.
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Lock-free log-linear latency histogram (HDR-style).
+ *
+ * Each power of two between 1us and 2^36ns (~69s) is split into four sub-buckets, so a
+ * recorded value lands in a bucket at most 25% wider than itself.
+ */
+class LatencyHistogram
+{
+public:
+    void record(uint64_t nanoseconds)
+    {
+        buckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    void writePrometheus(std::ostream &out, const char *name, const char *help) const
+    {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < finiteBuckets; i++)
+        {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            out << name << "_bucket{le=\"" << static_cast<double>(bucketUpperBound(i)) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        uint64_t total = count.load(std::memory_order_relaxed);
+        out << name << "_bucket{le=\"+Inf\"} " << total << "\n"
+            << name << "_sum " << static_cast<double>(sumNs.load(std::memory_order_relaxed)) / 1e9 << "\n"
+            << name << "_count " << total << "\n";
+    }
+
+private:
+    static constexpr uint32_t subBucketBits = 2;
+    static constexpr uint32_t minExponent = 10; // everything below 2^10 ns shares bucket 0
+    static constexpr uint32_t maxExponent = 36; // everything from 2^36 ns on only counts towards +Inf
+    static constexpr size_t finiteBuckets = (maxExponent - minExponent) * (1u << subBucketBits) + 1;
+
+    static size_t bucketIndex(uint64_t nanoseconds)
+    {
+        if (nanoseconds < (uint64_t(1) << minExponent)) return 0;
+        uint32_t exponent = static_cast<uint32_t>(std::bit_width(nanoseconds)) - 1;
+        if (exponent >= maxExponent) return finiteBuckets;
+        uint64_t subBucket = (nanoseconds >> (exponent - subBucketBits)) & ((1u << subBucketBits) - 1);
+        return 1 + (exponent - minExponent) * (1u << subBucketBits) + static_cast<size_t>(subBucket);
+    }
+
+    static uint64_t bucketUpperBound(size_t index)
+    {
+        if (index == 0) return uint64_t(1) << minExponent;
+        uint32_t exponent = minExponent + static_cast<uint32_t>((index - 1) >> subBucketBits);
+        uint64_t subBucket = (index - 1) & ((1u << subBucketBits) - 1);
+        return ((uint64_t(1) << subBucketBits) + subBucket + 1) << (exponent - subBucketBits);
+    }
+
+    std::array<std::atomic<uint64_t>, finiteBuckets + 1> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sumNs{0};
+};
+
+struct DaemonMetrics
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> requestErrors{0};
+    std::atomic<uint64_t> cacheHits{0};
+    std::atomic<uint64_t> cacheMisses{0};
+    std::atomic<uint64_t> bytesServed{0};
+    std::atomic<uint64_t> cachedSourceBytes{0};
+    LatencyHistogram requestLatency;
+    LatencyHistogram scanTime;
+};
+
+std::string formatPrometheusMetrics(const DaemonMetrics &metrics)
+{
+    std::ostringstream out;
+    auto counter = [&out](const char *name, const char *help, uint64_t value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n" << name << " " << value << "\n";
+    };
+    auto gauge = [&out](const char *name, const char *help, uint64_t value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " gauge\n" << name << " " << value << "\n";
+    };
+    counter("wgsl_requests_total", "Preprocessing requests handled.", metrics.requests.load(std::memory_order_relaxed));
+    counter("wgsl_request_errors_total", "Requests that failed or had unresolved includes.", metrics.requestErrors.load(std::memory_order_relaxed));
+    counter("wgsl_source_cache_hits_total", "Source loads served from the cache.", metrics.cacheHits.load(std::memory_order_relaxed));
+    counter("wgsl_source_cache_misses_total", "Source loads that read the file.", metrics.cacheMisses.load(std::memory_order_relaxed));
+    counter("wgsl_bytes_served_total", "Bundle bytes produced.", metrics.bytesServed.load(std::memory_order_relaxed));
+    gauge("wgsl_source_cache_bytes", "Source text held by the cache.", metrics.cachedSourceBytes.load(std::memory_order_relaxed));
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    uint64_t totalPages = 0, residentPages = 0;
+    if (statm >> totalPages >> residentPages)
+    {
+        gauge("wgsl_resident_memory_bytes", "Resident set size of the daemon.", residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)));
+    }
+#endif
+    out << "# HELP wgsl_memory_live_bytes Heap bytes currently allocated, by subsystem.\n# TYPE wgsl_memory_live_bytes gauge\n";
+    for (size_t i = 0; i < static_cast<size_t>(MemoryTag::Count); i++)
+    {
+        out << "wgsl_memory_live_bytes{subsystem=\"" << memoryTagNames[i] << "\"} "
+            << memoryCounters[i].liveBytes.load(std::memory_order_relaxed) << "\n";
+    }
+    metrics.requestLatency.writePrometheus(out, "wgsl_request_duration_seconds", "Time from request to response.");
+    metrics.scanTime.writePrometheus(out, "wgsl_scan_duration_seconds", "Time spent resolving includes per request.");
+    return out.str();
+}
+
+// ---------------------------------------------------------------------------
+// Daemon state snapshots
+//
+// The SourceCache is written on shutdown and periodically, and mapped again on startup so a
+// restarted daemon resumes warm. Layout (native endianness, each record 8-byte aligned):
+//   DaemonStateHeader
+//   per file: DaemonStateRecord, path bytes, text bytes, then per #include name a uint64
+//             length and its bytes, padded to the next multiple of 8
+// ---------------------------------------------------------------------------
+
+const char daemonStateMagic[8] = {'W', 'G', 'S', 'L', 'D', 'M', 'N', '1'};
+
+struct DaemonStateHeader
+{
+    char magic[8];
+    uint64_t fileCount;
+};
+
+struct DaemonStateRecord
+{
+    FileIdentity identity;
+    uint64_t pathLength;
+    uint64_t textLength;
+    uint64_t includeCount;
+};
+
+bool saveDaemonState(const std::filesystem::path &statePath, const SourceCache &sources)
+{
+    std::string state;
+    DaemonStateHeader header{};
+    std::memcpy(header.magic, daemonStateMagic, sizeof(header.magic));
+    state.append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    uint64_t fileCount = 0;
+    sources.forEach([&](const std::filesystem::path &filePath, const SourceFile &source) {
+        std::string pathText = filePath.string();
+        DaemonStateRecord record{source.identity, pathText.size(), source.text.size(), source.includes.size()};
+        state.append(reinterpret_cast<const char *>(&record), sizeof(record));
+        state += pathText;
+        state += source.text;
+        for (const auto &include : source.includes)
+        {
+            uint64_t length = include.size();
+            state.append(reinterpret_cast<const char *>(&length), sizeof(length));
+            state += include;
+        }
+        state.resize(roundUp(8, static_cast<uint32_t>(state.size())), '\0');
+        fileCount++;
+    });
+    std::memcpy(state.data() + offsetof(DaemonStateHeader, fileCount), &fileCount, sizeof(fileCount));
+
+    if (!writeFileAtomically(statePath, state))
+    {
+        std::cerr << "Error: Could not write daemon state: " << statePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Restores the sources recorded in a daemon state snapshot that are still current.
+ *
+ * @param statePath The snapshot written by saveDaemonState().
+ * @param sources The cache to fill.
+ * @return The number of sources restored.
+ */
+size_t loadDaemonState(const std::filesystem::path &statePath, SourceCache &sources)
+{
+    MappedFile mapping;
+    if (!mapping.open(statePath))
+    {
+        return 0; // first start, nothing to resume
+    }
+    const char *data = mapping.data();
+    size_t size = mapping.size();
+    DaemonStateHeader header;
+    if (size < sizeof(header) || std::memcmp(data, daemonStateMagic, sizeof(daemonStateMagic)) != 0)
+    {
+        std::cerr << "Warning: Ignoring invalid daemon state: " << statePath << std::endl;
+        return 0;
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    std::vector<std::filesystem::path> files;
+    std::vector<FileIdentity> identities;
+    std::vector<std::shared_ptr<SourceFile>> parsed;
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.fileCount; i++)
+    {
+        DaemonStateRecord record;
+        if (offset + sizeof(record) > size) break;
+        std::memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (offset + record.pathLength + record.textLength > size) break;
+
+        MemoryTagScope memoryTag(MemoryTag::Sources);
+        auto source = std::make_shared<SourceFile>();
+        source->identity = record.identity;
+        files.emplace_back(std::string(data + offset, record.pathLength));
+        offset += record.pathLength;
+        source->text.assign(data + offset, record.textLength);
+        offset += record.textLength;
+        for (uint64_t include = 0; include < record.includeCount && offset + sizeof(uint64_t) <= size; include++)
+        {
+            uint64_t length;
+            std::memcpy(&length, data + offset, sizeof(length));
+            offset += sizeof(length);
+            if (offset + length > size) break;
+            source->includes.emplace_back(data + offset, length);
+            offset += length;
+        }
+        offset = roundUp(8, static_cast<uint32_t>(offset));
+        identities.push_back(record.identity);
+        parsed.push_back(std::move(source));
+    }
+    if (parsed.size() != header.fileCount)
+    {
+        std::cerr << "Warning: Ignoring truncated daemon state: " << statePath << std::endl;
+        return 0;
+    }
+
+    std::vector<bool> unchanged = validateFileIdentities(files, identities);
+    size_t restored = 0;
+    for (size_t i = 0; i < parsed.size(); i++)
+    {
+        if (unchanged[i])
+        {
+            sources.insert(files[i], std::move(parsed[i]));
+            restored++;
+        }
+    }
+    return restored;
+}
+
+#ifndef _WIN32
+
+// How long the daemon waits on one client, or one metrics scrape, before dropping it.
+constexpr int daemonClientTimeoutSeconds = 5;
+
+std::chrono::steady_clock::time_point daemonClientDeadline()
+{
+    return std::chrono::steady_clock::now() + std::chrono::seconds(daemonClientTimeoutSeconds);
+}
+
+void requestDaemonStop(int)
+{
+    daemonStopRequested.store(true);
+}
+
+void serveMetrics(uint16_t port, const DaemonMetrics &metrics)
+{
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        std::cerr << "Error: Could not listen for metrics on 127.0.0.1:" << port << std::endl;
+        if (listener >= 0) close(listener);
+        return;
+    }
+    while (waitReadable(listener))
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) continue;
+        setSocketTimeouts(connection, daemonClientTimeoutSeconds); // bounds writing the response
+        char request[1024];
+        if (waitReadable(connection, daemonClientDeadline()) && read(connection, request, sizeof(request)) > 0) // any request gets the metrics
+        {
+            std::string body = formatPrometheusMetrics(metrics);
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                   std::to_string(body.size()) + "\r\n\r\n" + body;
+            writeAll(connection, response.data(), response.size());
+        }
+        close(connection);
+    }
+    close(listener);
+}
+
+int openUnixSocket(const std::string &socketPath, bool listening)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Error: Socket path too long: " << socketPath << std::endl;
+        return -1;
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    int descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (descriptor < 0) return -1;
+    if (listening)
+    {
+        unlink(socketPath.c_str()); // a socket left behind by a previous daemon
+        if (bind(descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 && listen(descriptor, 64) == 0)
+        {
+            return descriptor;
+        }
+    }
+    else if (connect(descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+    {
+        return descriptor;
+    }
+    close(descriptor);
+    return -1;
+}
+
+void handleDaemonRequest(int connection, SourceCache &sources, DaemonMetrics &metrics)
+{
+    auto requestStart = std::chrono::steady_clock::now();
+    std::string request;
+    if (!readLine(connection, request, daemonClientDeadline())) return;
+
+    size_t separator = request.find('\t');
+    std::filesystem::path entryPath = request.substr(0, separator);
+    std::string outputPath = separator == std::string::npos ? std::string() : request.substr(separator + 1);
+
+    std::string response;
+    std::error_code error;
+    entryPath = std::filesystem::canonical(entryPath, error);
+    if (error)
+    {
+        response = "ERROR cannot resolve input " + request.substr(0, separator) + "\n";
+        metrics.requestErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        sources.nextGeneration(); // files may have changed since the previous request
+        EntryResult result = preprocessEntry(entryPath, sources, nullptr);
+        metrics.scanTime.record(result.scanNs);
+        if (!result.ok) metrics.requestErrors.fetch_add(1, std::memory_order_relaxed);
+
+        std::string status = (result.ok ? "OK " : "FAILED ") + std::to_string(result.bundle.size()) + "\n";
+        if (outputPath.empty())
+        {
+            response = status + result.bundle;
+        }
+        else
+        {
+            response = writeFileAtomically(outputPath, result.bundle) ? status : "ERROR cannot write output " + outputPath + "\n";
+        }
+        metrics.bytesServed.fetch_add(result.bundle.size(), std::memory_order_relaxed);
+    }
+    writeAll(connection, response.data(), response.size());
+
+    metrics.requests.fetch_add(1, std::memory_order_relaxed);
+    metrics.cacheHits.store(sources.hits, std::memory_order_relaxed);
+    metrics.cacheMisses.store(sources.misses, std::memory_order_relaxed);
+    metrics.cachedSourceBytes.store(sources.cachedBytes, std::memory_order_relaxed);
+    metrics.requestLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - requestStart).count()));
+}
+
+/**
+ * @brief Runs the preprocessing daemon until SIGINT or SIGTERM.
+ *
+ * @param socketPath The Unix socket to accept requests on.
+ * @param metricsPort Port for the Prometheus endpoint on 127.0.0.1, or 0 for none.
+ * @param statePath Snapshot to resume from and save to, or empty for none.
+ * @param stateIntervalSeconds How often to save the snapshot while running, 0 for only on shutdown.
+ * @return The process exit code.
+ */
+int runDaemon(const std::string &socketPath, uint16_t metricsPort, const std::string &statePath, uint32_t stateIntervalSeconds)
+{
+    SourceCache sources;
+    sources.addProvider(std::make_unique<CompressedFileProvider>());
+    if (!statePath.empty())
+    {
+        auto loadStart = std::chrono::steady_clock::now();
+        size_t restored = loadDaemonState(statePath, sources);
+        if (restored > 0)
+        {
+            std::cerr << "Restored " << restored << " cached sources from " << statePath << " in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count()
+                      << "ms" << std::endl;
+        }
+    }
+
+    int listener = openUnixSocket(socketPath, true);
+    if (listener < 0)
+    {
+        std::cerr << "Error: Could not listen on socket: " << socketPath << std::endl;
+        return 1;
+    }
+    struct sigaction stopAction{};
+    stopAction.sa_handler = requestDaemonStop;
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
+    signal(SIGPIPE, SIG_IGN); // clients may hang up before reading the response
+
+    DaemonMetrics metrics;
+    std::thread metricsThread;
+    if (metricsPort != 0)
+    {
+        metricsThread = std::thread(serveMetrics, metricsPort, std::cref(metrics));
+    }
+
+    auto lastSave = std::chrono::steady_clock::now();
+    uint64_t missesAtLastSave = sources.misses;
+    pollfd pollDescriptor{listener, POLLIN, 0};
+    while (!daemonStopRequested.load())
+    {
+        if (poll(&pollDescriptor, 1, 200) > 0)
+        {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection >= 0)
+            {
+                setSocketTimeouts(connection, daemonClientTimeoutSeconds); // requests are served one at a time
+                handleDaemonRequest(connection, sources, metrics);
+                close(connection);
+            }
+        }
+        // Periodic snapshots only when something new was read since the last one
+        if (!statePath.empty() && stateIntervalSeconds > 0 && sources.misses != missesAtLastSave &&
+            std::chrono::steady_clock::now() - lastSave >= std::chrono::seconds(stateIntervalSeconds))
+        {
+            saveDaemonState(statePath, sources);
+            lastSave = std::chrono::steady_clock::now();
+            missesAtLastSave = sources.misses;
+        }
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    if (!statePath.empty())
+    {
+        saveDaemonState(statePath, sources);
+    }
+    if (metricsThread.joinable())
+    {
+        metricsThread.join();
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends one request to a running daemon and relays the result.
+ *
+ * @return The process exit code.
+ */
+int runClient(const std::string &socketPath, const std::filesystem::path &entryPath, const std::string &outputFile)
+{
+    int connection = openUnixSocket(socketPath, false);
+    if (connection < 0)
+    {
+        std::cerr << "Error: Could not connect to daemon at: " << socketPath << std::endl;
+        return 1;
+    }
+    std::string request = entryPath.string() + "\t" +
+                          (outputFile.empty() ? std::string() : std::filesystem::absolute(outputFile).string()) + "\n";
+    std::string status;
+    if (!writeAll(connection, request.data(), request.size()) || !readLine(connection, status))
+    {
+        std::cerr << "Error: Daemon closed the connection" << std::endl;
+        close(connection);
+        return 1;
+    }
+    if (status.rfind("ERROR", 0) == 0)
+    {
+        std::cerr << "Error: " << status.substr(6) << std::endl;
+        close(connection);
+        return 1;
+    }
+    if (status.rfind("FAILED", 0) == 0)
+    {
+        std::cerr << "findIncludes failed." << std::endl;
+    }
+    char buffer[65536];
+    ssize_t received;
+    while ((received = read(connection, buffer, sizeof(buffer))) > 0)
+    {
+        std::cout.write(buffer, received);
+    }
+    close(connection);
+    return 0;
+}
+
+void serveCacheConnection(int connection, std::filesystem::path objectDir, CacheDirectory *cache)
+{
+    std::string request;
+    while (readLine(connection, request))
+    {
+        std::string response;
+        std::istringstream words(request);
+        std::string verb;
+        std::string key;
+        uint64_t size = 0;
+        words >> verb >> key;
+        if (!isRemoteCacheKey(key))
+        {
+            response = "ERROR bad key\n";
+        }
+        else if (verb == "GET")
+        {
+            std::string bundle;
+            FileIdentity identity;
+            bool hit = readWholeFile(objectDir / key, bundle, identity);
+            response = hit ? "HIT " + std::to_string(bundle.size()) + "\n" + bundle : "MISS\n";
+            if (hit) cache->touch("remote/" + key, bundle.size());
+        }
+        else if (verb == "PUT" && words >> size && size <= maxRemoteObjectSize)
+        {
+            std::string bundle;
+            if (!readExactly(connection, static_cast<size_t>(size), bundle)) break;
+            // Objects are immutable: a key already present holds the same bytes
+            std::error_code error;
+            bool present = std::filesystem::exists(objectDir / key, error);
+            bool stored = !present && writeFileAtomically(objectDir / key, bundle);
+            response = present || stored ? "OK\n" : "ERROR cannot store object\n";
+            if (stored) cache->stored("remote/" + key, bundle.size());
+        }
+        else
+        {
+            response = "ERROR bad request\n";
+        }
+        if (!writeAll(connection, response.data(), response.size()) || response.rfind("ERROR", 0) == 0) break;
+    }
+    close(connection);
+}
+
+/**
+ * @brief Runs the reference --remote-cache server until SIGINT or SIGTERM.
+ *
+ * @param listenAddress "[<IPv4 address>:]<port>"; the address defaults to 127.0.0.1.
+ * @param cacheDir Objects are kept in <cacheDir>/remote, one file per key.
+ * @param cacheSize Byte cap on the cache directory, or 0 for none.
+ * @return The process exit code.
+ */
+int runCacheServer(const std::string &listenAddress, const std::string &cacheDir, uint64_t cacheSize)
+{
+    size_t colon = listenAddress.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : listenAddress.substr(0, colon);
+    std::string port = colon == std::string::npos ? listenAddress : listenAddress.substr(colon + 1);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(std::atoi(port.c_str())));
+    std::filesystem::path objectDir = std::filesystem::path(cacheDir) / "remote";
+    std::error_code error;
+    std::filesystem::create_directories(objectDir, error);
+    // Shared with detached connection threads, so it is never destroyed
+    static CacheDirectory *cache = new CacheDirectory;
+    cache->configure(cacheDir, cacheSize);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (error || inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 || listener < 0 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        std::cerr << "Error: Could not serve the cache on " << host << ":" << port << " from " << objectDir << std::endl;
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+    struct sigaction stopAction{};
+    stopAction.sa_handler = requestDaemonStop;
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    // A thread per connection: clients keep theirs open for a whole build
+    while (waitReadable(listener))
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection >= 0) std::thread(serveCacheConnection, connection, objectDir, cache).detach();
+    }
+    close(listener);
+    return 0;
+}
+
+#endif // _WIN32
+
+#ifndef _WIN32
+
+/**
+ * @brief Measures exec-to-exit time of this binary on one shader.
+ *
+ * Each run spawns the tool with "--no-plan <input> /dev/null" and waits for it, so the figure
+ * covers dynamic loading, static initialization, argument handling and the actual
+ * preprocessing, every time: without a plan no run can take the up-to-date shortcut.
+ * With a log file, one CSV row (unix time, binary, runs, min/median/p90 in microseconds) is
+ * appended per invocation so startup can be tracked over time.
+ *
+ * @return The process exit code.
+ */
+int runStartupBenchmark(const char *programPath, const std::string &inputFile, uint32_t runs, const std::string &logFile)
+{
+#ifdef __linux__
+    const char *executable = "/proc/self/exe";
+#else
+    const char *executable = programPath;
+#endif
+    std::vector<char *> childArguments = {const_cast<char *>(programPath), const_cast<char *>("--no-plan"),
+                                          const_cast<char *>(inputFile.c_str()), const_cast<char *>("/dev/null"), nullptr};
+    std::vector<double> microseconds;
+    for (uint32_t run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pid_t child;
+        if (posix_spawn(&child, executable, nullptr, nullptr, childArguments.data(), environ) != 0)
+        {
+            std::cerr << "Error: Could not spawn " << executable << std::endl;
+            return 1;
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        microseconds.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "Error: Benchmark run failed for " << inputFile << std::endl;
+            return 1;
+        }
+    }
+    std::sort(microseconds.begin(), microseconds.end());
+    double minimum = microseconds.front();
+    double median = microseconds[microseconds.size() / 2];
+    double p90 = microseconds[microseconds.size() * 9 / 10];
+    std::cout << "startup over " << runs << " runs: min " << minimum << "us, median " << median << "us, p90 " << p90 << "us" << std::endl;
+
+    if (!logFile.empty())
+    {
+        std::ofstream log(logFile, std::ios::app);
+        log << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+            << "," << programPath << "," << runs << "," << minimum << "," << median << "," << p90 << "\n";
+    }
+    return 0;
+}
+
+#endif // _WIN32
+
+struct Options
+{
+    std::string inputFile;
+    std::string outputFile;           // empty for stdout
+    std::string layoutHeaderFile;     // --emit-layout
+    std::string prefixSnapshotFile;   // --prefix
+    std::string writePrefixFile;      // --write-prefix
+    bool emissionPlans = true;        // --no-plan
+    bool check = false;               // --check
+    std::vector<std::string> checkFiles;
+    std::string serveSocket;          // --serve
+    std::string connectSocket;        // --connect
+    uint16_t metricsPort = 0;         // --metrics-port
+    std::string daemonStateFile;      // --state
+    uint32_t stateIntervalSeconds = 300; // --state-interval
+    bool memoryStats = false;         // --mem-stats
+    uint32_t benchmarkRuns = 0;       // --bench-startup
+    std::string benchmarkLogFile;     // --bench-log
+    std::string batchFile;            // --batch
+    bool deduplicateOutputs = false;  // --dedup-outputs
+    bool semanticKeys = false;        // --semantic-key
+    std::map<std::string, std::string> defines; // -D
+    std::set<std::string> undefines;  // -U
+    bool residual = false;            // --residual
+    std::string cacheDir;             // --cache-dir
+    uint64_t cacheSize = 0;           // --cache-size, 0 for unbounded
+    std::vector<std::pair<std::string, std::string>> generators; // --generator name=command
+    std::vector<std::string> archives; // --archive
+    std::string gitRevision;          // --git-rev
+    std::string gitDirectory;         // --git-dir
+    std::vector<DefineAxis> axes;     // --axis
+    std::string remoteCache;          // --remote-cache
+    std::string cacheServer;          // --cache-server
+    std::string depFile;              // --depfile
+    std::string projectRoot;          // --project-root
+    std::string journalFile;          // --journal
+};
+
+void printUsage(const char *programName)
+{
+    std::cerr << "Usage: " << programName << " [options] <input_file> [output_file]\n"
+              << "       " << programName << " --check <output_file>...\n"
+              << "       " << programName << " --batch <list_file>\n"
+              << "Options:\n"
+              << "  --emit-layout <header>   Write C++ mirrors of the bundle's host-shareable structs\n"
+              << "  --write-prefix <file>    Snapshot the resolved input so other entries can start from it\n"
+              << "  --prefix <file>          Start from a snapshot written by --write-prefix\n"
+              << "  -D <name>[=<value>]      Resolve #if/#ifdef blocks with this define (repeatable)\n"
+              << "  -U <name>                Treat the define as known to be undefined (for --residual)\n"
+              << "  --residual               Fold -D/-U defines only; keep #if blocks on any other name\n"
+              << "  --axis <name>[=<v>,...]  Write one variant per value (default: undefined, defined), skipping\n"
+              << "                           axes no reachable condition depends on; see <output_file>.variants\n"
+              << "  --archive <file.tar|zip> Read <file>/<member> paths from inside the archive (repeatable)\n"
+              << "  --git-rev <rev>          Read files under the work tree from this commit of its .git; <rev> is a\n"
+              << "                           full commit id, HEAD, a branch or a tag, optionally with ~<n> or ^<n>\n"
+              << "  --git-dir <dir>          The .git directory for --git-rev (default: found above the executable)\n"
+              << "  --generator <name>=<cmd> Serve #include \"gen:<name>?<args>\" from the output of the shell\n"
+              << "                           command <cmd>, which gets <args> as $1; run once per argument string.\n"
+              << "                           Relative #includes in its output resolve from the first includer\n"
+              << "  --cache-dir <dir>        Keep generated #embed tables here, by content hash\n"
+              << "  --cache-size <n>[K|M|G]  Evict least recently used --cache-dir entries beyond this many bytes\n"
+              << "  --depfile <file>         Write a Makefile-style depfile listing every input of the output\n"
+              << "  --project-root <dir>     Record paths under <dir> relative to it in plans, journals and\n"
+              << "                           --remote-cache keys, so they hold across checkout locations\n"
+              << "  --remote-cache <host>:<port> Fetch bundles built elsewhere from the same inputs, and share\n"
+              << "                           ours, through a server such as --cache-server\n"
+              << "  --cache-server [<addr>:]<port> Serve a --remote-cache from <--cache-dir>/remote\n"
+              << "  --no-plan                Do not keep <output_file>.plan for replaying unchanged builds\n"
+              << "  --check                  Exit with 1 if any output is out of date; writes nothing\n"
+              << "  --batch <list_file>      Process \"<input_file> <output_file>\" lines, overlapping their stages\n"
+              << "  --journal <file>         With --batch, record finished entries and skip them when rerun unchanged\n"
+              << "  --dedup-outputs          Store identical outputs once, as reflinks or hardlinks\n"
+              << "  --semantic-key           Write <output_file>.key ignoring comments and whitespace, and keep\n"
+              << "                           outputs whose meaning did not change\n"
+              << "  --serve <socket>         Run as a daemon answering requests on a Unix socket (plain and\n"
+              << "                           compressed files; not with --archive, --git-rev, --generator,\n"
+              << "                           --prefix, -D, -U, --residual or --axis)\n"
+              << "  --metrics-port <port>    With --serve, expose Prometheus metrics on 127.0.0.1:<port>\n"
+              << "  --state <file>           With --serve, resume from and save a snapshot of the daemon's cache\n"
+              << "  --state-interval <secs>  How often to save --state while running (default 300, 0 = on exit)\n"
+              << "  --connect <socket>       Send the request to a running daemon\n"
+              << "  --mem-stats              Report heap usage per subsystem on stderr (WGSL_MEMORY_STATS builds)\n"
+              << "  --bench-startup <runs>   Time exec-to-exit of this binary on the input file\n"
+              << "  --bench-log <csv>        Append --bench-startup results to a CSV file" << std::endl;
+}
+
+bool parseArguments(int argc, char *argv[], Options &options)
+{
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--emit-layout" && i + 1 < argc)
+        {
+            options.layoutHeaderFile = argv[++i];
+        }
+        else if (argument == "--prefix" && i + 1 < argc)
+        {
+            options.prefixSnapshotFile = argv[++i];
+        }
+        else if (argument == "--write-prefix" && i + 1 < argc)
+        {
+            options.writePrefixFile = argv[++i];
+        }
+        else if (argument == "--check")
+        {
+            options.check = true;
+        }
+        else if (argument == "--no-plan")
+        {
+            options.emissionPlans = false;
+        }
+        else if (argument == "--batch" && i + 1 < argc)
+        {
+            options.batchFile = argv[++i];
+        }
+        else if (argument.rfind("-D", 0) == 0 && (argument.size() > 2 || i + 1 < argc))
+        {
+            std::string define = argument.size() > 2 ? argument.substr(2) : argv[++i];
+            size_t equals = define.find('=');
+            options.defines[define.substr(0, equals)] = equals == std::string::npos ? "1" : define.substr(equals + 1);
+        }
+        else if (argument.rfind("-U", 0) == 0 && (argument.size() > 2 || i + 1 < argc))
+        {
+            options.undefines.insert(argument.size() > 2 ? argument.substr(2) : argv[++i]);
+        }
+        else if (argument == "--archive" && i + 1 < argc)
+        {
+            options.archives.push_back(argv[++i]);
+        }
+        else if (argument == "--git-rev" && i + 1 < argc)
+        {
+            options.gitRevision = argv[++i];
+        }
+        else if (argument == "--git-dir" && i + 1 < argc)
+        {
+            options.gitDirectory = argv[++i];
+        }
+        else if (argument == "--generator" && i + 1 < argc)
+        {
+            std::string generator = argv[++i];
+            size_t equals = generator.find('=');
+            if (equals == std::string::npos || equals == 0)
+            {
+                std::cerr << "Error: Expected --generator <name>=<command>, got: " << generator << std::endl;
+                return false;
+            }
+            options.generators.emplace_back(generator.substr(0, equals), generator.substr(equals + 1));
+        }
+        else if (argument == "--remote-cache" && i + 1 < argc)
+        {
+            options.remoteCache = argv[++i];
+        }
+        else if (argument == "--cache-server" && i + 1 < argc)
+        {
+            options.cacheServer = argv[++i];
+        }
+        else if (argument == "--journal" && i + 1 < argc)
+        {
+            options.journalFile = argv[++i];
+        }
+        else if (argument == "--project-root" && i + 1 < argc)
+        {
+            options.projectRoot = argv[++i];
+        }
+        else if (argument == "--depfile" && i + 1 < argc)
+        {
+            options.depFile = argv[++i];
+        }
+        else if (argument == "--cache-size" && i + 1 < argc)
+        {
+            std::string size = argv[++i];
+            char *end = nullptr;
+            options.cacheSize = std::strtoull(size.c_str(), &end, 10);
+            std::string suffix = end;
+            if (suffix == "K" || suffix == "k") options.cacheSize <<= 10;
+            else if (suffix == "M" || suffix == "m") options.cacheSize <<= 20;
+            else if (suffix == "G" || suffix == "g") options.cacheSize <<= 30;
+            else if (!suffix.empty() || end == size.c_str())
+            {
+                std::cerr << "Error: Expected --cache-size <bytes>[K|M|G], got: " << size << std::endl;
+                return false;
+            }
+        }
+        else if (argument == "--cache-dir" && i + 1 < argc)
+        {
+            options.cacheDir = argv[++i];
+        }
+        else if (argument == "--residual")
+        {
+            options.residual = true;
+        }
+        else if (argument == "--axis" && i + 1 < argc)
+        {
+            std::string axisArgument = argv[++i];
+            size_t equals = axisArgument.find('=');
+            DefineAxis axis;
+            axis.name = axisArgument.substr(0, equals);
+            if (equals == std::string::npos)
+            {
+                axis.values = {std::nullopt, std::string()};
+            }
+            else
+            {
+                std::stringstream values(axisArgument.substr(equals + 1));
+                std::string value;
+                while (std::getline(values, value, ','))
+                {
+                    axis.values.emplace_back(value);
+                }
+            }
+            if (axis.name.empty() || axis.values.empty())
+            {
+                std::cerr << "Error: --axis needs a name and at least one value: " << axisArgument << std::endl;
+                return false;
+            }
+            options.axes.push_back(std::move(axis));
+        }
+        else if (argument == "--semantic-key")
+        {
+            options.semanticKeys = true;
+        }
+        else if (argument == "--dedup-outputs")
+        {
+            options.deduplicateOutputs = true;
+        }
+        else if (argument == "--serve" && i + 1 < argc)
+        {
+            options.serveSocket = argv[++i];
+        }
+        else if (argument == "--connect" && i + 1 < argc)
+        {
+            options.connectSocket = argv[++i];
+        }
+        else if (argument == "--bench-startup" && i + 1 < argc)
+        {
+            options.benchmarkRuns = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument == "--bench-log" && i + 1 < argc)
+        {
+            options.benchmarkLogFile = argv[++i];
+        }
+        else if (argument == "--mem-stats")
+        {
+            options.memoryStats = true;
+        }
+        else if (argument == "--state" && i + 1 < argc)
+        {
+            options.daemonStateFile = argv[++i];
+        }
+        else if (argument == "--state-interval" && i + 1 < argc)
+        {
+            options.stateIntervalSeconds = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument == "--metrics-port" && i + 1 < argc)
+        {
+            options.metricsPort = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument.rfind("--", 0) == 0)
+        {
+            std::cerr << "Error: Unknown option: " << argument << std::endl;
+            return false;
+        }
+        else
+        {
+            positional.push_back(argument);
+        }
+    }
+    if (!options.serveSocket.empty())
+    {
+        // the daemon takes its inputs from requests, and serves plain and compressed files as they are
+        return positional.empty() && options.archives.empty() && options.gitRevision.empty() && options.generators.empty() &&
+               options.prefixSnapshotFile.empty() && options.defines.empty() && options.undefines.empty() && !options.residual &&
+               options.axes.empty();
+    }
+    if (!options.cacheServer.empty())
+    {
+        return positional.empty() && !options.cacheDir.empty();
+    }
+    if (!options.batchFile.empty())
+    {
+        // every entry of the list has its own output, so there is nothing to share a layout header or prefix with
+        return positional.empty() && options.layoutHeaderFile.empty() && options.writePrefixFile.empty() && options.axes.empty() &&
+               options.depFile.empty();
+    }
+    if (options.check)
+    {
+        options.checkFiles = positional;
+        return !positional.empty();
+    }
+    if (positional.empty() || positional.size() > 2)
+    {
+        return false;
+    }
+    options.inputFile = positional[0];
+    if (positional.size() == 2)
+    {
+        options.outputFile = positional[1];
+    }
+    // variants are named after the output file, and a depfile's target is the output file
+    return ((options.axes.empty() && options.depFile.empty()) || !options.outputFile.empty()) && options.journalFile.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseArguments(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1; // Indicate error
+    }
+
+    if (!options.serveSocket.empty())
+    {
+#ifdef _WIN32
+        std::cerr << "Error: --serve is not supported on this platform" << std::endl;
+        return 1;
+#else
+        return runDaemon(options.serveSocket, options.metricsPort, options.daemonStateFile, options.stateIntervalSeconds);
+#endif
+    }
+
+    if (!options.cacheServer.empty())
+    {
+#ifdef _WIN32
+        std::cerr << "Error: --cache-server is not supported on this platform" << std::endl;
+        return 1;
+#else
+        return runCacheServer(options.cacheServer, options.cacheDir, options.cacheSize);
+#endif
+    }
+
+    std::filesystem::path projectRoot;
+    if (!options.projectRoot.empty())
+    {
+        std::error_code error;
+        projectRoot = std::filesystem::canonical(options.projectRoot, error);
+        if (error)
+        {
+            std::cerr << "Error: Could not resolve --project-root: " << options.projectRoot << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.check)
+    {
+        return runCheck(options.checkFiles, projectRoot);
+    }
+
+    if (options.benchmarkRuns > 0)
+    {
+#ifdef _WIN32
+        std::cerr << "Error: --bench-startup is not supported on this platform" << std::endl;
+        return 1;
+#else
+        return runStartupBenchmark(argv[0], options.inputFile, options.benchmarkRuns, options.benchmarkLogFile);
+#endif
+    }
+
+    // 1. Determine the directory of the executable
+    std::filesystem::path executablePath = std::filesystem::absolute(argv[0]);
+    std::filesystem::path programBaseDir = executablePath.parent_path(); // This is the executable's directory
+
+    JobContext context;
+    context.emissionPlans = options.emissionPlans && options.writePrefixFile.empty();
+    context.alwaysAssemble = !options.layoutHeaderFile.empty();
+    context.needsIncludes = !options.writePrefixFile.empty();
+    context.prefixSnapshotFile = options.prefixSnapshotFile;
+    context.projectRoot = projectRoot;
+    context.deduplicateOutputs = options.deduplicateOutputs;
+    context.semanticKeys = options.semanticKeys;
+    context.cache.configure(options.cacheDir, options.cacheSize);
+    context.embeds = EmbedCache(options.cacheDir, &context.cache);
+    context.remote.configure(options.remoteCache);
+    for (const auto &archive : options.archives)
+    {
+        std::error_code error;
+        std::filesystem::path archivePath = std::filesystem::canonical(programBaseDir / archive, error);
+        if (error)
+        {
+            std::cerr << "Error: Could not open archive: " << archive << std::endl;
+            return 1;
+        }
+        context.sources.addProvider(std::make_unique<ArchiveProvider>(archivePath));
+    }
+    if (!options.gitRevision.empty())
+    {
+#ifdef WGSL_HAVE_ZLIB
+        std::filesystem::path workTree;
+        std::filesystem::path gitDirectory;
+        std::error_code error;
+        if (!options.gitDirectory.empty())
+        {
+            gitDirectory = std::filesystem::canonical(programBaseDir / options.gitDirectory, error);
+            workTree = gitDirectory.parent_path();
+        }
+        else if (!GitProvider::discover(std::filesystem::canonical(programBaseDir, error), workTree, gitDirectory))
+        {
+            error = std::make_error_code(std::errc::no_such_file_or_directory);
+        }
+        if (error)
+        {
+            std::cerr << "Error: Could not find the git directory for --git-rev" << std::endl;
+            return 1;
+        }
+        auto git = std::make_unique<GitProvider>();
+        if (!git->open(std::filesystem::canonical(workTree), gitDirectory, options.gitRevision)) return 1;
+        context.sources.addProvider(std::move(git));
+#else
+        std::cerr << "Error: --git-rev needs a build with zlib" << std::endl;
+        return 1;
+#endif
+    }
+    if (!options.generators.empty())
+    {
+        auto generators = std::make_unique<GeneratorProvider>();
+        for (const auto &[name, command] : options.generators)
+        {
+            context.generators += "generator " + name + "=" + command + "\n";
+            generators->add(name, [command](std::string_view arguments, std::string &text) {
+                return runGeneratorCommand(command, arguments, text);
+            });
+        }
+        context.sources.addProvider(std::move(generators));
+    }
+    context.sources.addProvider(std::make_unique<CompressedFileProvider>()); // after archives, which may hold .gz members
+    context.defines.values = options.defines;
+    context.defines.undefined = options.undefines;
+    context.defines.othersUnknown = options.residual;
+    context.conditionals = (!options.defines.empty() || !options.undefines.empty() || options.residual) && options.axes.empty();
+    if (!options.axes.empty())
+    {
+        context.emissionPlans = false; // one bundle, many outputs: nothing a single plan could check
+    }
+
+    if (!options.batchFile.empty())
+    {
+        int status = runBatch(options.batchFile, programBaseDir, context, options.journalFile);
+        if (options.memoryStats)
+        {
+            printMemoryStats(std::cerr);
+        }
+        return status;
+    }
+
+    // 2. Resolve the input file path relative to the executable's directory
+    EntryJob job;
+    job.inputFile = options.inputFile;
+    job.outputFile = options.outputFile;
+    if (!resolveInputPath(programBaseDir, options.inputFile, context.sources, job.entryPath))
+    {
+        return 1;
+    }
+    const std::filesystem::path &absoluteInitialFilePath = job.entryPath;
+
+    if (!options.connectSocket.empty())
+    {
+#ifdef _WIN32
+        std::cerr << "Error: --connect is not supported on this platform" << std::endl;
+        return 1;
+#else
+        return runClient(options.connectSocket, absoluteInitialFilePath, options.outputFile);
+#endif
+    }
+
+    // Replay the previous build's plan if none of its inputs changed, otherwise resolve and assemble
+    prepareEntryJob(job, context, false);
+    resolveEntryJob(job, context);
+    assembleEntryJob(job, context);
+    if (!options.axes.empty())
+    {
+        if (!writeVariants(job.result.bundle, options.outputFile, context.defines, options.axes))
+        {
+            return 1;
+        }
+    }
+    else if (!writeEntryJob(job, context))
+    {
+        return 1;
+    }
+    if (!options.depFile.empty())
+    {
+        if (!writeDepfile(options.depFile, options.outputFile, jobPlan(job).files, context.sources))
+        {
+            std::cerr << "Error: Could not write depfile: " << options.depFile << std::endl;
+            return 1;
+        }
+    }
+    const EntryResult &result = job.result;
+    const std::string &bundle = result.bundle;
+
+    if (!options.writePrefixFile.empty())
+    {
+        std::vector<std::filesystem::path> includes = result.files;
+        if (result.prefixReached)
+        {
+            for (const auto &prefixFile : context.prefix()->files)
+            {
+                includes.push_back(prefixFile.first);
+            }
+        }
+        if (!writePrefixSnapshot(options.writePrefixFile, includes, bundle))
+        {
+            return 1;
+        }
+    }
+
+    if (!options.layoutHeaderFile.empty() &&
+        !writeLayoutHeader(bundle, options.layoutHeaderFile, absoluteInitialFilePath.filename().string()))
+    {
+        return 1;
+    }
+
+    if (options.memoryStats)
+    {
+        printMemoryStats(std::cerr);
+    }
+
+    // The output is still written with what could be resolved, but the build has failed
+    if (!job.upToDate && !job.replayed && !result.ok)
+    {
+        return 1;
+    }
+    return 0; // Indicate success
+}
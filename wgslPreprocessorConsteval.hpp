@@ -0,0 +1,284 @@
+#pragma once
+
+// Compile-time version of wgslPreprocessor's include resolution, for shaders embedded in a
+// native binary. Given a table of (name, source) string literals it produces the same bundle
+// the tool would write for the entry, and its hashBytes() value, as constants:
+//
+//     inline constexpr wgsl::SourceFile shaders[] = {
+//         {"common/math.wgsl", "fn square(x: f32) -> f32 { return x * x; }\n"},
+//         {"main.wgsl", "#include \"common/math.wgsl\"\n@compute @workgroup_size(1) fn main() {}\n"},
+//     };
+//     constexpr auto bundle = wgsl::resolveIncludes<shaders, "main.wgsl">();
+//     // bundle.view() is a std::string_view, bundle.hash a uint64_t; both usable in constant expressions
+//
+// Names are paths relative to one common root; includes are resolved against the including
+// file's directory with "." and ".." folded, like the tool does on disk (symlinks aside).
+// A missing include is a compile error.
+//
+// Requires C++20 (constexpr std::string and std::vector).
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wgsl
+{
+
+struct SourceFile
+{
+    std::string_view name;
+    std::string_view source;
+};
+
+// A string literal usable as a template argument.
+template <size_t N>
+struct FixedString
+{
+    char data[N] = {};
+
+    consteval FixedString(const char (&text)[N])
+    {
+        for (size_t i = 0; i < N; i++) data[i] = text[i];
+    }
+
+    constexpr std::string_view view() const { return std::string_view(data, N - 1); }
+};
+
+template <size_t N>
+struct Bundle
+{
+    std::array<char, N + 1> text = {}; // zero-terminated
+    uint64_t hash = 0;
+
+    constexpr std::string_view view() const { return std::string_view(text.data(), N); }
+    constexpr const char *c_str() const { return text.data(); }
+};
+
+namespace detail
+{
+
+// Same as hashBytes() in wgslPreprocessor.cpp: MurmurHash64A, 8-byte blocks read little-endian.
+constexpr uint64_t hashBytes(std::string_view data, uint64_t seed = 0)
+{
+    const uint64_t multiplier = 0xc6a4a7935bd1e995ULL;
+    const int shift = 47;
+    uint64_t hash = seed ^ (data.size() * multiplier);
+
+    size_t blockEnd = data.size() & ~size_t(7);
+    for (size_t i = 0; i < blockEnd; i += 8)
+    {
+        uint64_t block = 0;
+        for (size_t byte = 0; byte < 8; byte++)
+        {
+            block |= uint64_t(static_cast<unsigned char>(data[i + byte])) << (8 * byte);
+        }
+        block *= multiplier;
+        block ^= block >> shift;
+        block *= multiplier;
+        hash ^= block;
+        hash *= multiplier;
+    }
+    if (data.size() & 7)
+    {
+        for (size_t i = data.size() & 7; i > 0; i--)
+        {
+            hash ^= uint64_t(static_cast<unsigned char>(data[blockEnd + i - 1])) << (8 * (i - 1));
+        }
+        hash *= multiplier;
+    }
+    hash ^= hash >> shift;
+    hash *= multiplier;
+    hash ^= hash >> shift;
+    return hash;
+}
+
+constexpr std::vector<std::string_view> splitPath(std::string_view path)
+{
+    std::vector<std::string_view> parts;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        size_t end = path.find('/', start);
+        if (end == std::string_view::npos) end = path.size();
+        std::string_view part = path.substr(start, end - start);
+        if (part == "..")
+        {
+            if (!parts.empty()) parts.pop_back();
+        }
+        else if (!part.empty() && part != ".")
+        {
+            parts.push_back(part);
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+// Joins the include name onto the including file's directory and folds "." and "..".
+constexpr std::string resolvePath(std::string_view includingFile, std::string_view name)
+{
+    std::string joined;
+    if (!name.starts_with('/'))
+    {
+        size_t slash = includingFile.rfind('/');
+        if (slash != std::string_view::npos) joined = std::string(includingFile.substr(0, slash + 1));
+    }
+    joined += name;
+
+    std::string normalized;
+    for (std::string_view part : splitPath(joined))
+    {
+        if (!normalized.empty()) normalized += '/';
+        normalized += part;
+    }
+    return normalized;
+}
+
+// std::filesystem::path ordering: component by component, which the tool's std::map follows.
+constexpr bool pathLess(std::string_view a, std::string_view b)
+{
+    std::vector<std::string_view> left = splitPath(a);
+    std::vector<std::string_view> right = splitPath(b);
+    for (size_t i = 0; i < left.size() && i < right.size(); i++)
+    {
+        if (left[i] != right[i]) return left[i] < right[i];
+    }
+    return left.size() < right.size();
+}
+
+template <size_t N>
+constexpr const SourceFile &find(const SourceFile (&table)[N], std::string_view name)
+{
+    for (const auto &file : table)
+    {
+        if (splitPath(file.name) == splitPath(name)) return file;
+    }
+    throw "wgsl::resolveIncludes: an included file is not in the table";
+}
+
+// The "#include \"name\"" lines near the top of a source; stops after five lines without one.
+constexpr std::vector<std::string_view> scanIncludes(std::string_view text)
+{
+    const std::string_view prefix = "#include \"";
+    std::vector<std::string_view> includes;
+    uint32_t nothingFoundCount = 0;
+    size_t lineStart = 0;
+    while (lineStart < text.size() && nothingFoundCount < 5)
+    {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) lineEnd = text.size();
+        std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        if (line.starts_with(prefix))
+        {
+            size_t endQuote = line.find('"', prefix.size());
+            if (endQuote != std::string_view::npos)
+            {
+                includes.push_back(line.substr(prefix.size(), endQuote - prefix.size()));
+                nothingFoundCount = 0;
+            }
+        }
+        else
+        {
+            nothingFoundCount++;
+        }
+    }
+    return includes;
+}
+
+struct ActiveInclude
+{
+    std::string name;
+    uint32_t depth;
+};
+
+// Mirrors findIncludes(): the deepest depth each file is reached at decides its position.
+template <size_t N>
+constexpr void findIncludes(const SourceFile (&table)[N], const std::string &name, uint32_t depth, std::vector<ActiveInclude> &active)
+{
+    bool seen = false;
+    for (auto &include : active)
+    {
+        if (include.name != name) continue;
+        if (include.depth < depth)
+        {
+            include.depth = depth;
+            return;
+        }
+        seen = true;
+    }
+    const SourceFile &file = find(table, name);
+    if (!seen) active.push_back({name, depth});
+    for (std::string_view include : scanIncludes(file.source))
+    {
+        findIncludes(table, resolvePath(name, include), depth + 1, active);
+    }
+}
+
+template <size_t N>
+constexpr std::string assemble(const SourceFile (&table)[N], std::string_view entry)
+{
+    std::vector<ActiveInclude> active;
+    findIncludes(table, resolvePath("", entry), 0, active);
+
+    // Deepest first, ties in path order: an insertion sort is stable and the lists are short
+    for (size_t i = 1; i < active.size(); i++)
+    {
+        for (size_t j = i; j > 0; j--)
+        {
+            const ActiveInclude &a = active[j - 1];
+            const ActiveInclude &b = active[j];
+            bool before = b.depth > a.depth || (b.depth == a.depth && pathLess(b.name, a.name));
+            if (!before) break;
+            ActiveInclude moved = active[j];
+            active[j] = active[j - 1];
+            active[j - 1] = moved;
+        }
+    }
+
+    std::string bundle;
+    for (const auto &include : active)
+    {
+        std::string_view text = find(table, include.name).source;
+        size_t lineStart = 0;
+        while (lineStart < text.size())
+        {
+            size_t lineEnd = text.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos) lineEnd = text.size();
+            std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+            if (line.find("#include") == std::string_view::npos)
+            {
+                bundle += line;
+                bundle += '\n';
+            }
+            lineStart = lineEnd + 1;
+        }
+    }
+    return bundle;
+}
+
+} // namespace detail
+
+/**
+ * @brief Resolves the entry's includes from the table at compile time.
+ *
+ * @tparam Table A constexpr array of SourceFile with static storage duration.
+ * @tparam Entry The name of the entry file in the table.
+ * @return The bundle wgslPreprocessor would write for the entry, and its hash.
+ */
+template <const auto &Table, FixedString Entry>
+consteval auto resolveIncludes()
+{
+    constexpr size_t size = detail::assemble(Table, Entry.view()).size();
+    Bundle<size> bundle;
+    std::string text = detail::assemble(Table, Entry.view());
+    for (size_t i = 0; i < size; i++) bundle.text[i] = text[i];
+    bundle.hash = detail::hashBytes(text);
+    return bundle;
+}
+
+} // namespace wgsl